@@ -0,0 +1,869 @@
+#include "bitmap.h"
+
+#include <algorithm>
+
+namespace
+{
+
+typedef Bitmap::Container Container;
+
+// an array container never holds more values than this; 4096 16-bit values take exactly as much
+// space as a bitset container.
+const int array_max = 4096;
+const int nwords = 1 << 16 >> 6;
+
+int
+popcount(const std::vector<uint64_t> & words)
+{
+  int n = 0;
+  for (auto w : words)
+    n += __builtin_popcountll(w);
+  return n;
+}
+
+// sets bits [start, end] (inclusive) of words.
+void
+setRange(std::vector<uint64_t> & words, uint32_t start, uint32_t end)
+{
+  uint32_t first = start >> 6;
+  uint32_t last = end >> 6;
+  uint64_t lomask = ~uint64_t(0) << (start & 63);
+  uint64_t himask = ~uint64_t(0) >> (63 - (end & 63));
+  if (first == last)
+  {
+    words[first] |= lomask & himask;
+    return;
+  }
+  words[first] |= lomask;
+  for (uint32_t w = first + 1; w < last; w++)
+    words[w] = ~uint64_t(0);
+  words[last] |= himask;
+}
+
+// clears bits [start, end] (inclusive) of words.
+void
+clearRange(uint64_t * words, uint32_t start, uint32_t end)
+{
+  uint32_t first = start >> 6;
+  uint32_t last = end >> 6;
+  uint64_t lomask = ~uint64_t(0) << (start & 63);
+  uint64_t himask = ~uint64_t(0) >> (63 - (end & 63));
+  if (first == last)
+  {
+    words[first] &= ~(lomask & himask);
+    return;
+  }
+  words[first] &= ~lomask;
+  for (uint32_t w = first + 1; w < last; w++)
+    words[w] = 0;
+  words[last] &= ~himask;
+}
+
+bool
+testBit(const Container & c, uint16_t v)
+{
+  return (c.words[v >> 6] >> (v & 63)) & 1;
+}
+
+// returns the index in c.vals of the run holding v, or -1 if v isn't in c.
+long
+findRun(const Container & c, uint16_t v)
+{
+  // binary search for the last run starting at or before v.
+  size_t lo = 0;
+  size_t hi = c.vals.size() / 2;
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (c.vals[2 * mid] <= v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return -1;
+  size_t r = 2 * (lo - 1);
+  return v - c.vals[r] <= c.vals[r + 1] ? r : -1;
+}
+
+bool
+runContains(const Container & c, uint16_t v)
+{
+  return findRun(c, v) >= 0;
+}
+
+bool
+containerContains(const Container & c, uint16_t v)
+{
+  switch (c.type)
+  {
+    case Container::Array:
+      return std::binary_search(c.vals.begin(), c.vals.end(), v);
+    case Container::Bits:
+      return testBit(c, v);
+    case Container::Run:
+      return runContains(c, v);
+  }
+  return false;
+}
+
+int
+countRuns(const Container & c)
+{
+  switch (c.type)
+  {
+    case Container::Run:
+      return c.vals.size() / 2;
+    case Container::Array:
+    {
+      int n = 0;
+      for (size_t i = 0; i < c.vals.size(); i++)
+        if (i == 0 || c.vals[i] != c.vals[i - 1] + 1)
+          n++;
+      return n;
+    }
+    case Container::Bits:
+    {
+      // a run starts at every set bit whose predecessor is clear.
+      int n = 0;
+      uint64_t carry = 0;
+      for (auto w : c.words)
+      {
+        n += __builtin_popcountll(w & ~((w << 1) | carry));
+        carry = w >> 63;
+      }
+      return n;
+    }
+  }
+  return 0;
+}
+
+// ANDs words with the bits of c, which must be a bitset or run container.
+void
+andWords(uint64_t * words, const Container & c)
+{
+  if (c.type == Container::Bits)
+  {
+    for (int w = 0; w < nwords; w++)
+      words[w] &= c.words[w];
+    return;
+  }
+  // clear the gaps before, between and after the runs.
+  uint32_t next = 0;
+  for (size_t r = 0; r < c.vals.size(); r += 2)
+  {
+    if (c.vals[r] > next)
+      clearRange(words, next, c.vals[r] - 1);
+    next = uint32_t(c.vals[r]) + c.vals[r + 1] + 1;
+  }
+  if (next <= 0xFFFF)
+    clearRange(words, next, 0xFFFF);
+}
+
+// clears the bits of the values of c in words.
+void
+andNotWords(uint64_t * words, const Container & c)
+{
+  switch (c.type)
+  {
+    case Container::Array:
+      for (auto v : c.vals)
+        words[v >> 6] &= ~(uint64_t(1) << (v & 63));
+      break;
+    case Container::Bits:
+      for (int w = 0; w < nwords; w++)
+        words[w] &= ~c.words[w];
+      break;
+    case Container::Run:
+      for (size_t r = 0; r < c.vals.size(); r += 2)
+        clearRange(words, c.vals[r], c.vals[r] + c.vals[r + 1]);
+      break;
+  }
+}
+
+Container
+toBits(const Container & c)
+{
+  Container out;
+  out.type = Container::Bits;
+  out.card = c.card;
+  out.words.assign(nwords, 0);
+  switch (c.type)
+  {
+    case Container::Array:
+      for (auto v : c.vals)
+        out.words[v >> 6] |= uint64_t(1) << (v & 63);
+      break;
+    case Container::Bits:
+      out.words = c.words;
+      break;
+    case Container::Run:
+      for (size_t r = 0; r < c.vals.size(); r += 2)
+        setRange(out.words, c.vals[r], c.vals[r] + c.vals[r + 1]);
+      break;
+  }
+  return out;
+}
+
+Container
+toArray(const Container & c)
+{
+  if (c.type == Container::Array)
+    return c;
+  Container out;
+  out.card = c.card;
+  out.vals.reserve(c.card);
+  if (c.type == Container::Bits)
+  {
+    for (uint32_t w = 0; w < nwords; w++)
+      for (uint64_t bits = c.words[w]; bits != 0; bits &= bits - 1)
+        out.vals.push_back(w * 64 + __builtin_ctzll(bits));
+  }
+  else
+  {
+    for (size_t r = 0; r < c.vals.size(); r += 2)
+      for (uint32_t v = c.vals[r], end = v + c.vals[r + 1]; v <= end; v++)
+        out.vals.push_back(v);
+  }
+  return out;
+}
+
+Container
+toRuns(const Container & c)
+{
+  if (c.type == Container::Run)
+    return c;
+  Container out;
+  out.type = Container::Run;
+  out.card = c.card;
+  out.vals.reserve(2 * countRuns(c));
+  auto push = [&out](uint32_t v) {
+    if (!out.vals.empty() && uint32_t(out.vals[out.vals.size() - 2]) + out.vals.back() + 1 == v)
+      out.vals.back()++;
+    else
+    {
+      out.vals.push_back(v);
+      out.vals.push_back(0);
+    }
+  };
+  if (c.type == Container::Array)
+    for (auto v : c.vals)
+      push(v);
+  else
+    for (uint32_t w = 0; w < nwords; w++)
+      for (uint64_t bits = c.words[w]; bits != 0; bits &= bits - 1)
+        push(w * 64 + __builtin_ctzll(bits));
+  return out;
+}
+
+// converts the result of a set operation to the cheapest representation that does not require
+// counting runs.  Run results stay runs unless an array or a bitset would be smaller.
+void
+normalize(Container & c)
+{
+  if (c.type == Container::Bits && c.card <= array_max)
+    c = toArray(c);
+  else if (c.type == Container::Array && c.card > array_max)
+    c = toBits(c);
+  else if (c.type == Container::Run && c.card <= array_max && c.card < int(c.vals.size()))
+    c = toArray(c);
+  else if (c.type == Container::Run && c.vals.size() > 4 * nwords)
+    c = toBits(c);
+}
+
+Container
+bitsFromWords(std::vector<uint64_t> && words)
+{
+  Container out;
+  out.type = Container::Bits;
+  out.card = popcount(words);
+  out.words = std::move(words);
+  normalize(out);
+  return out;
+}
+
+// keeps the values of the array container a for which keep(v) is true.
+template <typename Pred>
+Container
+filterArray(const Container & a, Pred keep)
+{
+  Container out;
+  out.vals.reserve(a.vals.size());
+  for (auto v : a.vals)
+    if (keep(v))
+      out.vals.push_back(v);
+  out.card = out.vals.size();
+  return out;
+}
+
+Container
+intersectRuns(const Container & a, const Container & b)
+{
+  Container out;
+  out.type = Container::Run;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.vals.size() && j < b.vals.size())
+  {
+    uint32_t astart = a.vals[i], aend = astart + a.vals[i + 1];
+    uint32_t bstart = b.vals[j], bend = bstart + b.vals[j + 1];
+    uint32_t start = std::max(astart, bstart);
+    uint32_t end = std::min(aend, bend);
+    if (start <= end)
+    {
+      out.vals.push_back(start);
+      out.vals.push_back(end - start);
+      out.card += end - start + 1;
+    }
+    if (aend < bend)
+      i += 2;
+    else
+      j += 2;
+  }
+  normalize(out);
+  return out;
+}
+
+Container
+uniteRuns(const Container & a, const Container & b)
+{
+  Container out;
+  out.type = Container::Run;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.vals.size() || j < b.vals.size())
+  {
+    // take the next run by start position from whichever container has it.
+    bool froma = j >= b.vals.size() || (i < a.vals.size() && a.vals[i] <= b.vals[j]);
+    auto & vals = froma ? a.vals : b.vals;
+    size_t & k = froma ? i : j;
+    uint32_t start = vals[k];
+    uint32_t end = start + vals[k + 1];
+    k += 2;
+
+    size_t n = out.vals.size();
+    if (n > 0 && start <= uint32_t(out.vals[n - 2]) + out.vals[n - 1] + 1)
+    {
+      uint32_t prevend = out.vals[n - 2] + out.vals[n - 1];
+      if (end > prevend)
+      {
+        out.card += end - prevend;
+        out.vals[n - 1] = end - out.vals[n - 2];
+      }
+    }
+    else
+    {
+      out.vals.push_back(start);
+      out.vals.push_back(end - start);
+      out.card += end - start + 1;
+    }
+  }
+  normalize(out);
+  return out;
+}
+
+Container
+intersect(const Container & a, const Container & b)
+{
+  if (a.type == Container::Array && b.type == Container::Array)
+  {
+    Container out;
+    std::set_intersection(a.vals.begin(), a.vals.end(), b.vals.begin(), b.vals.end(),
+                          std::back_inserter(out.vals));
+    out.card = out.vals.size();
+    return out;
+  }
+  if (a.type == Container::Array)
+    return filterArray(a, [&b](uint16_t v) { return containerContains(b, v); });
+  if (b.type == Container::Array)
+    return filterArray(b, [&a](uint16_t v) { return containerContains(a, v); });
+  if (a.type == Container::Run && b.type == Container::Run)
+    return intersectRuns(a, b);
+
+  auto bits = a.type == Container::Bits ? a.words : toBits(a).words;
+  auto & other = b.type == Container::Bits ? b : toBits(b);
+  for (int w = 0; w < nwords; w++)
+    bits[w] &= other.words[w];
+  return bitsFromWords(std::move(bits));
+}
+
+Container
+unite(const Container & a, const Container & b)
+{
+  if (a.type == Container::Array && b.type == Container::Array)
+  {
+    Container out;
+    out.vals.reserve(a.vals.size() + b.vals.size());
+    std::set_union(a.vals.begin(), a.vals.end(), b.vals.begin(), b.vals.end(),
+                   std::back_inserter(out.vals));
+    out.card = out.vals.size();
+    normalize(out);
+    return out;
+  }
+  if (a.type == Container::Run && b.type == Container::Run)
+    return uniteRuns(a, b);
+
+  auto bits = a.type == Container::Bits ? a.words : toBits(a).words;
+  if (b.type == Container::Array)
+    for (auto v : b.vals)
+      bits[v >> 6] |= uint64_t(1) << (v & 63);
+  else if (b.type == Container::Run)
+    for (size_t r = 0; r < b.vals.size(); r += 2)
+      setRange(bits, b.vals[r], b.vals[r] + b.vals[r + 1]);
+  else
+    for (int w = 0; w < nwords; w++)
+      bits[w] |= b.words[w];
+  return bitsFromWords(std::move(bits));
+}
+
+Container
+subtract(const Container & a, const Container & b)
+{
+  if (a.type == Container::Array)
+  {
+    if (b.type == Container::Array)
+    {
+      Container out;
+      std::set_difference(a.vals.begin(), a.vals.end(), b.vals.begin(), b.vals.end(),
+                          std::back_inserter(out.vals));
+      out.card = out.vals.size();
+      return out;
+    }
+    return filterArray(a, [&b](uint16_t v) { return !containerContains(b, v); });
+  }
+
+  auto bits = a.type == Container::Bits ? a.words : toBits(a).words;
+  if (b.type == Container::Array)
+    for (auto v : b.vals)
+      bits[v >> 6] &= ~(uint64_t(1) << (v & 63));
+  else
+  {
+    auto & other = b.type == Container::Bits ? b : toBits(b);
+    for (int w = 0; w < nwords; w++)
+      bits[w] &= ~other.words[w];
+  }
+  return bitsFromWords(std::move(bits));
+}
+
+} // namespace
+
+void
+Bitmap::add(uint32_t x)
+{
+  uint16_t key = x >> 16;
+  uint16_t low = x & 0xFFFF;
+
+  size_t i = _keys.size() - 1;
+  if (_keys.empty() || _keys.back() != key)
+  {
+    auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+    i = it - _keys.begin();
+    if (it == _keys.end() || *it != key)
+    {
+      _keys.insert(it, key);
+      _containers.insert(_containers.begin() + i, Container());
+    }
+  }
+
+  auto & c = _containers[i];
+  switch (c.type)
+  {
+    case Container::Array:
+    {
+      if (c.vals.empty() || c.vals.back() < low)
+        c.vals.push_back(low);
+      else
+      {
+        auto it = std::lower_bound(c.vals.begin(), c.vals.end(), low);
+        if (*it == low)
+          return;
+        c.vals.insert(it, low);
+      }
+      c.card++;
+      if (c.card > array_max)
+        c = toBits(c);
+      break;
+    }
+    case Container::Bits:
+      if (!testBit(c, low))
+      {
+        c.words[low >> 6] |= uint64_t(1) << (low & 63);
+        c.card++;
+      }
+      break;
+    case Container::Run:
+    {
+      if (runContains(c, low))
+        return;
+      size_t n = c.vals.size();
+      if (n > 0 && uint32_t(c.vals[n - 2]) + c.vals[n - 1] + 1 == low)
+        c.vals[n - 1]++;
+      else if (n == 0 || c.vals[n - 2] < low)
+      {
+        c.vals.push_back(low);
+        c.vals.push_back(0);
+      }
+      else
+      {
+        // out of order insert into the middle of the runs; fall back to a bitset and let the
+        // next optimize pick the representation again.
+        c = toBits(c);
+        c.words[low >> 6] |= uint64_t(1) << (low & 63);
+      }
+      c.card++;
+      break;
+    }
+  }
+}
+
+bool
+Bitmap::remove(uint32_t x)
+{
+  uint16_t key = x >> 16;
+  uint16_t low = x & 0xFFFF;
+  auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+  if (it == _keys.end() || *it != key)
+    return false;
+  size_t i = it - _keys.begin();
+  auto & c = _containers[i];
+
+  switch (c.type)
+  {
+    case Container::Array:
+    {
+      auto v = std::lower_bound(c.vals.begin(), c.vals.end(), low);
+      if (v == c.vals.end() || *v != low)
+        return false;
+      c.vals.erase(v);
+      c.card--;
+      break;
+    }
+    case Container::Bits:
+      if (!testBit(c, low))
+        return false;
+      c.words[low >> 6] &= ~(uint64_t(1) << (low & 63));
+      c.card--;
+      if (c.card <= array_max)
+        c = toArray(c);
+      break;
+    case Container::Run:
+    {
+      long r = findRun(c, low);
+      if (r < 0)
+        return false;
+      uint16_t start = c.vals[r];
+      uint16_t end = start + c.vals[r + 1];
+      if (start == end)
+        c.vals.erase(c.vals.begin() + r, c.vals.begin() + r + 2);
+      else if (low == start)
+      {
+        c.vals[r]++;
+        c.vals[r + 1]--;
+      }
+      else if (low == end)
+        c.vals[r + 1]--;
+      else if (c.vals.size() >= size_t(array_max))
+      {
+        // splitting would make the runs bigger than a bitset; like add, switch to one and let
+        // the next optimize pick the representation again.
+        c = toBits(c);
+        c.words[low >> 6] &= ~(uint64_t(1) << (low & 63));
+      }
+      else
+      {
+        // split the run around low.
+        c.vals[r + 1] = low - 1 - start;
+        uint16_t rest[] = {uint16_t(low + 1), uint16_t(end - low - 1)};
+        c.vals.insert(c.vals.begin() + r + 2, rest, rest + 2);
+      }
+      c.card--;
+      break;
+    }
+  }
+
+  if (c.card == 0)
+  {
+    _keys.erase(_keys.begin() + i);
+    _containers.erase(_containers.begin() + i);
+  }
+  return true;
+}
+
+bool
+Bitmap::contains(uint32_t x) const
+{
+  uint16_t key = x >> 16;
+  auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+  if (it == _keys.end() || *it != key)
+    return false;
+  return containerContains(_containers[it - _keys.begin()], x & 0xFFFF);
+}
+
+uint64_t
+Bitmap::cardinality() const
+{
+  uint64_t n = 0;
+  for (auto & c : _containers)
+    n += c.card;
+  return n;
+}
+
+const Bitmap::Container *
+Bitmap::find(uint16_t key) const
+{
+  auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+  if (it == _keys.end() || *it != key)
+    return nullptr;
+  return &_containers[it - _keys.begin()];
+}
+
+template <typename Sparse, typename Dense>
+void
+Bitmap::forEachCommonBlock(const std::vector<const Bitmap *> & bitmaps, const Bitmap * excluded, Sparse sparse,
+                           Dense dense)
+{
+  auto & first = *bitmaps[0];
+  for (size_t k = 0; k < first._keys.size(); k++)
+  {
+    uint16_t key = first._keys[k];
+    const Container * array = nullptr;
+    bool missing = false;
+    for (auto b : bitmaps)
+    {
+      auto c = b->find(key);
+      if (!c)
+      {
+        missing = true;
+        break;
+      }
+      if (c->type == Container::Array && (!array || c->card < array->card))
+        array = c;
+    }
+    if (missing)
+      continue;
+    auto ex = excluded ? excluded->find(key) : nullptr;
+
+    if (array)
+    {
+      // bit i of alive says whether array->vals[i] is still in the intersection.
+      uint64_t alive[array_max / 64];
+      int nalive = (array->vals.size() + 63) / 64;
+      for (int w = 0; w < nalive; w++)
+        alive[w] = ~uint64_t(0);
+      if (array->vals.size() % 64)
+        alive[nalive - 1] = ~uint64_t(0) >> (64 - array->vals.size() % 64);
+      auto filter = [&](const Container & c, bool keep) {
+        for (int w = 0; w < nalive; w++)
+          for (uint64_t bits = alive[w]; bits != 0; bits &= bits - 1)
+          {
+            int i = w * 64 + __builtin_ctzll(bits);
+            if (containerContains(c, array->vals[i]) != keep)
+              alive[w] &= ~(uint64_t(1) << (i & 63));
+          }
+      };
+      for (auto b : bitmaps)
+      {
+        auto c = b->find(key);
+        if (c != array)
+          filter(*c, true);
+      }
+      if (ex)
+        filter(*ex, false);
+      if (!sparse(key, array->vals.data(), alive, nalive))
+        return;
+    }
+    else
+    {
+      uint64_t words[nwords];
+      auto & c0 = first._containers[k];
+      if (c0.type == Container::Bits)
+        std::copy(c0.words.begin(), c0.words.end(), words);
+      else
+      {
+        // set the words the runs touch, then clear the gaps between them.
+        std::fill(words, words + nwords, 0);
+        for (size_t r = 0; r < c0.vals.size(); r += 2)
+          for (uint32_t w = c0.vals[r] >> 6, last = (c0.vals[r] + c0.vals[r + 1]) >> 6; w <= last; w++)
+            words[w] = ~uint64_t(0);
+        andWords(words, c0);
+      }
+      for (size_t i = 1; i < bitmaps.size(); i++)
+        andWords(words, *bitmaps[i]->find(key));
+      if (ex)
+        andNotWords(words, *ex);
+      if (!dense(key, words))
+        return;
+    }
+  }
+}
+
+uint64_t
+Bitmap::countCommon(const std::vector<const Bitmap *> & bitmaps, const Bitmap * excluded, uint64_t limit)
+{
+  uint64_t n = 0;
+  forEachCommonBlock(
+      bitmaps,
+      excluded,
+      [&](uint16_t, const uint16_t *, const uint64_t * alive, int nalive) {
+        for (int w = 0; w < nalive; w++)
+          n += __builtin_popcountll(alive[w]);
+        return n < limit;
+      },
+      [&](uint16_t, const uint64_t * words) {
+        for (int w = 0; w < nwords; w++)
+          n += __builtin_popcountll(words[w]);
+        return n < limit;
+      });
+  return std::min(n, limit);
+}
+
+void
+Bitmap::appendCommon(const std::vector<const Bitmap *> & bitmaps, const Bitmap * excluded, std::vector<int> & out,
+                     uint64_t limit)
+{
+  if (limit == 0)
+    return;
+  uint64_t end = out.size() + std::min<uint64_t>(limit, UINT64_MAX - out.size());
+  forEachCommonBlock(
+      bitmaps,
+      excluded,
+      [&](uint16_t key, const uint16_t * vals, const uint64_t * alive, int nalive) {
+        uint32_t high = uint32_t(key) << 16;
+        for (int w = 0; w < nalive; w++)
+          for (uint64_t bits = alive[w]; bits != 0; bits &= bits - 1)
+          {
+            out.push_back(high | vals[w * 64 + __builtin_ctzll(bits)]);
+            if (out.size() == end)
+              return false;
+          }
+        return true;
+      },
+      [&](uint16_t key, const uint64_t * words) {
+        uint32_t high = uint32_t(key) << 16;
+        for (uint32_t w = 0; w < nwords; w++)
+          for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1)
+          {
+            out.push_back(high | (w * 64 + __builtin_ctzll(bits)));
+            if (out.size() == end)
+              return false;
+          }
+        return true;
+      });
+}
+
+void
+Bitmap::optimize()
+{
+  for (auto & c : _containers)
+  {
+    size_t runbytes = 4 * countRuns(c);
+    size_t arraybytes = c.card <= array_max ? 2 * c.card : SIZE_MAX;
+    size_t bitsbytes = 8 * nwords;
+    if (runbytes < arraybytes && runbytes < bitsbytes)
+      c = toRuns(c);
+    else if (arraybytes <= bitsbytes)
+      c = toArray(c);
+    else
+      c = toBits(c);
+    c.vals.shrink_to_fit();
+  }
+  _keys.shrink_to_fit();
+  _containers.shrink_to_fit();
+}
+
+size_t
+Bitmap::bytes() const
+{
+  size_t n = sizeof(*this) + _keys.capacity() * sizeof(uint16_t) +
+             _containers.capacity() * sizeof(Container);
+  for (auto & c : _containers)
+    n += c.vals.capacity() * sizeof(uint16_t) + c.words.capacity() * sizeof(uint64_t);
+  return n;
+}
+
+void
+Bitmap::toVector(std::vector<int> & out) const
+{
+  out.reserve(out.size() + cardinality());
+  forEach([&out](uint32_t x) { out.push_back(x); });
+}
+
+Bitmap
+operator&(const Bitmap & a, const Bitmap & b)
+{
+  Bitmap out;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a._keys.size() && j < b._keys.size())
+  {
+    if (a._keys[i] < b._keys[j])
+      i++;
+    else if (a._keys[i] > b._keys[j])
+      j++;
+    else
+    {
+      auto c = intersect(a._containers[i], b._containers[j]);
+      if (c.card > 0)
+      {
+        out._keys.push_back(a._keys[i]);
+        out._containers.push_back(std::move(c));
+      }
+      i++;
+      j++;
+    }
+  }
+  return out;
+}
+
+Bitmap
+operator|(const Bitmap & a, const Bitmap & b)
+{
+  Bitmap out;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a._keys.size() || j < b._keys.size())
+  {
+    if (j >= b._keys.size() || (i < a._keys.size() && a._keys[i] < b._keys[j]))
+    {
+      out._keys.push_back(a._keys[i]);
+      out._containers.push_back(a._containers[i++]);
+    }
+    else if (i >= a._keys.size() || b._keys[j] < a._keys[i])
+    {
+      out._keys.push_back(b._keys[j]);
+      out._containers.push_back(b._containers[j++]);
+    }
+    else
+    {
+      out._keys.push_back(a._keys[i]);
+      out._containers.push_back(unite(a._containers[i++], b._containers[j++]));
+    }
+  }
+  return out;
+}
+
+Bitmap
+operator-(const Bitmap & a, const Bitmap & b)
+{
+  Bitmap out;
+  size_t j = 0;
+  for (size_t i = 0; i < a._keys.size(); i++)
+  {
+    while (j < b._keys.size() && b._keys[j] < a._keys[i])
+      j++;
+    if (j < b._keys.size() && b._keys[j] == a._keys[i])
+    {
+      auto c = subtract(a._containers[i], b._containers[j]);
+      if (c.card == 0)
+        continue;
+      out._keys.push_back(a._keys[i]);
+      out._containers.push_back(std::move(c));
+    }
+    else
+    {
+      out._keys.push_back(a._keys[i]);
+      out._containers.push_back(a._containers[i]);
+    }
+  }
+  return out;
+}
@@ -0,0 +1,132 @@
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Bitmap is a compressed set of 32-bit integers in the style of Roaring bitmaps (see
+// http://roaringbitmap.org).  Values are grouped into 64K blocks by their high 16 bits and every
+// block is kept in whichever container suits its contents: a sorted array of the low 16 bits for
+// sparse blocks, a plain 8 kB bitset for dense ones, or a list of runs for blocks made of long
+// stretches of consecutive values.  Set operations work container by container and pick a
+// specialized routine for each pair of container types.
+class Bitmap
+{
+public:
+  // Container holds the low 16 bits of the values of one 64K block.
+  struct Container
+  {
+    enum Type : uint8_t
+    {
+      Array,
+      Bits,
+      Run,
+    };
+
+    Type type = Array;
+    int card = 0;
+    // Array: sorted values.  Run: sorted, disjoint (start, length - 1) pairs.
+    std::vector<uint16_t> vals;
+    // Bits: bit i of the block is bit i % 64 of word i / 64.
+    std::vector<uint64_t> words;
+  };
+
+  // adds x to the set.  Adding values in increasing order is the fast path.
+  void add(uint32_t x);
+  // removes x from the set; returns false if it wasn't in the set.
+  bool remove(uint32_t x);
+  bool contains(uint32_t x) const;
+  uint64_t cardinality() const;
+  bool empty() const { return _keys.empty(); }
+
+  // converts each container to the smallest of its possible representations (in particular to
+  // runs where those are smaller).  Meant to be called once a bulk load is done.
+  void optimize();
+
+  // returns the number of bytes used by the bitmap including its heap allocations.
+  size_t bytes() const;
+
+  Bitmap & operator&=(const Bitmap & other) { return *this = *this & other; }
+  Bitmap & operator|=(const Bitmap & other) { return *this = *this | other; }
+  Bitmap & operator-=(const Bitmap & other) { return *this = *this - other; }
+
+  // intersection, union and difference (a AND NOT b) of two bitmaps.
+  friend Bitmap operator&(const Bitmap & a, const Bitmap & b);
+  friend Bitmap operator|(const Bitmap & a, const Bitmap & b);
+  friend Bitmap operator-(const Bitmap & a, const Bitmap & b);
+
+  // counts the values that are in all of bitmaps (at least one) but not in excluded (if given),
+  // stopping as soon as the count reaches limit.  Unlike chaining operator& it builds no bitmap
+  // and doesn't allocate: sparse blocks are counted by probing the values of the smallest array
+  // container, dense ones with popcounts of ANDed words.
+  static uint64_t countCommon(const std::vector<const Bitmap *> & bitmaps, const Bitmap * excluded = nullptr,
+                              uint64_t limit = UINT64_MAX);
+
+  // appends the values that are in all of bitmaps (at least one) but not in excluded (if given)
+  // to out in increasing order, the first limit of them at most.  Like countCommon it builds no
+  // intermediate bitmaps, so it only allocates when out needs to grow.
+  static void appendCommon(const std::vector<const Bitmap *> & bitmaps, const Bitmap * excluded,
+                           std::vector<int> & out, uint64_t limit = UINT64_MAX);
+
+  // calls f(x) for every value x in the set in increasing order.
+  template <typename F>
+  void forEach(F f) const;
+
+  // appends every value in the set to out in increasing order.
+  void toVector(std::vector<int> & out) const;
+
+private:
+  template <typename F>
+  static void forEachLow(const Container & c, F f);
+
+  // returns the container of the block with the given key, or null if the block is empty.
+  const Container * find(uint16_t key) const;
+
+  // intersects bitmaps block by block, less excluded, for countCommon and appendCommon.  Blocks
+  // with an array container among bitmaps go to sparse(key, vals, alive, nalive), where bit i of
+  // the nalive words of alive says whether vals[i] is in the intersection; the others go to
+  // dense(key, words) with the intersection as a bitset.  Both return false to stop early.
+  template <typename Sparse, typename Dense>
+  static void forEachCommonBlock(const std::vector<const Bitmap *> & bitmaps, const Bitmap * excluded,
+                                 Sparse sparse, Dense dense);
+
+  std::vector<uint16_t> _keys;
+  std::vector<Container> _containers;
+};
+
+template <typename F>
+void
+Bitmap::forEachLow(const Container & c, F f)
+{
+  switch (c.type)
+  {
+    case Container::Array:
+      for (auto v : c.vals)
+        f(v);
+      break;
+    case Container::Bits:
+      for (uint32_t w = 0; w < c.words.size(); w++)
+        for (uint64_t bits = c.words[w]; bits != 0; bits &= bits - 1)
+          f(w * 64 + __builtin_ctzll(bits));
+      break;
+    case Container::Run:
+      for (size_t r = 0; r < c.vals.size(); r += 2)
+        for (uint32_t v = c.vals[r], end = v + c.vals[r + 1]; v <= end; v++)
+          f(v);
+      break;
+  }
+}
+
+template <typename F>
+void
+Bitmap::forEach(F f) const
+{
+  for (size_t i = 0; i < _keys.size(); i++)
+  {
+    uint32_t high = uint32_t(_keys[i]) << 16;
+    forEachLow(_containers[i], [&](uint32_t low) { f(high | low); });
+  }
+}
+
+#endif // BITMAP_H_
@@ -0,0 +1,72 @@
+#include "epoch.h"
+
+#include <cstdint>
+#include <thread>
+
+Epochs::Epochs() : _epoch(1)
+{
+  for (auto & slot : _slots)
+    slot.epoch = idle;
+}
+
+Epochs::~Epochs()
+{
+  for (auto & r : _retired)
+    r.deleter();
+}
+
+Epochs::Guard
+Epochs::pin()
+{
+  // every thread starts looking for a free slot at its own place so that concurrent readers
+  // rarely compete for the same slot.
+  static thread_local int start = std::hash<std::thread::id>()(std::this_thread::get_id()) % nslots;
+  for (int i = start;; i = (i + 1) % nslots)
+  {
+    // storing a possibly outdated epoch is fine: an older pin only keeps more objects around.
+    uint64_t expected = idle;
+    if (_slots[i].epoch.compare_exchange_strong(expected, _epoch.load()))
+      return Guard(this, i);
+    if (i == (start + nslots - 1) % nslots)
+      std::this_thread::yield();
+  }
+}
+
+void
+Epochs::unpin(int slot)
+{
+  _slots[slot].epoch.store(idle);
+}
+
+void
+Epochs::retire(std::function<void()> deleter)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  // readers pinned from now on can't reach the object anymore; those pinned at an epoch up to
+  // the current one might.
+  _retired.push_back({_epoch.fetch_add(1), std::move(deleter)});
+  if (_retired.size() % collect_every == 0)
+    collect();
+}
+
+void
+Epochs::collect()
+{
+  uint64_t oldest = UINT64_MAX;
+  for (auto & slot : _slots)
+  {
+    uint64_t e = slot.epoch.load();
+    if (e != idle && e < oldest)
+      oldest = e;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < _retired.size(); i++)
+  {
+    if (_retired[i].epoch < oldest)
+      _retired[i].deleter();
+    else if (n++ != i)
+      _retired[n - 1] = std::move(_retired[i]);
+  }
+  _retired.resize(n);
+}
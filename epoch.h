@@ -0,0 +1,91 @@
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Epochs provides epoch-based reclamation: writers replace data that lock-free readers may still
+// be looking at and retire the old version instead of deleting it.  Readers pin the current epoch
+// for as long as they use any such data, and a retired object is deleted once every reader that
+// was pinned when it got retired has unpinned.  Readers never wait; writers never wait for
+// readers either, they just leave retired objects around while old pins remain.
+class Epochs
+{
+public:
+  // Guard keeps the epoch pinned by the calling thread until it is destroyed.
+  class Guard
+  {
+  public:
+    Guard(Guard && other) : _epochs(other._epochs), _slot(other._slot) { other._epochs = nullptr; }
+    ~Guard()
+    {
+      if (_epochs)
+        _epochs->unpin(_slot);
+    }
+
+    Guard(const Guard &) = delete;
+    Guard & operator=(const Guard &) = delete;
+
+  private:
+    friend class Epochs;
+    Guard(Epochs * epochs, int slot) : _epochs(epochs), _slot(slot) {}
+
+    Epochs * _epochs;
+    int _slot;
+  };
+
+  Epochs();
+  // deletes all retired objects; there must be no pinned readers left.
+  ~Epochs();
+
+  Epochs(const Epochs &) = delete;
+  Epochs & operator=(const Epochs &) = delete;
+
+  // pins the current epoch.  Data a reader loads after pinning stays valid until the guard is
+  // gone.  Up to nslots readers can be pinned at the same time; more wait for a free slot.
+  Guard pin();
+
+  // deletes p once no reader can still be using it, i.e. once it has been unpublished (so that
+  // new readers can't find it) and all readers pinned before then have unpinned.
+  template <typename T>
+  void retire(const T * p)
+  {
+    retire([p] { delete p; });
+  }
+
+  void retire(std::function<void()> deleter);
+
+private:
+  void unpin(int slot);
+  // runs the deleters of the objects no pinned reader can be using.
+  void collect();
+
+  static const int nslots = 128;
+  // collect runs every this many retired objects.
+  static const int collect_every = 64;
+  // a slot's value when no reader holds it.
+  static const uint64_t idle = 0;
+
+  // slots on separate cache lines so that readers pinning in different slots don't contend.
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> epoch;
+  };
+
+  struct Retired
+  {
+    uint64_t epoch;
+    std::function<void()> deleter;
+  };
+
+  std::atomic<uint64_t> _epoch;
+  Slot _slots[nslots];
+
+  std::mutex _mutex;
+  std::vector<Retired> _retired;
+};
+
+#endif // EPOCH_H_
@@ -0,0 +1,270 @@
+#include "intersect.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+namespace
+{
+
+// galloping pays off once one list is this many times longer than the other.
+const size_t gallop_ratio = 32;
+
+} // namespace
+
+size_t
+intersectScalar(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+  while (i < na && j < nb)
+  {
+    if (a[i] < b[j])
+      i++;
+    else if (b[j] < a[i])
+      j++;
+    else
+    {
+      out[k++] = a[i];
+      i++;
+      j++;
+    }
+  }
+  return k;
+}
+
+size_t
+intersectGallop(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  size_t j = 0;
+  size_t k = 0;
+  for (size_t i = 0; i < na && j < nb; i++)
+  {
+    int x = a[i];
+    if (b[j] < x)
+    {
+      // double the step until b[hi] >= x, then binary search (lo, hi].
+      size_t lo = j;
+      size_t step = 1;
+      while (lo + step < nb && b[lo + step] < x)
+      {
+        lo += step;
+        step *= 2;
+      }
+      size_t hi = std::min(lo + step, nb);
+      j = std::lower_bound(b + lo + 1, b + hi, x) - b;
+      if (j == nb)
+        break;
+    }
+    if (b[j] == x)
+    {
+      out[k++] = x;
+      j++;
+    }
+  }
+  return k;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+namespace
+{
+
+// ShuffleTables maps the match mask of a block comparison to the shuffle that packs the matching
+// lanes to the front of the register.
+struct ShuffleTables
+{
+  ShuffleTables()
+  {
+    for (int mask = 0; mask < 16; mask++)
+    {
+      int n = 0;
+      for (int lane = 0; lane < 4; lane++)
+        if (mask & (1 << lane))
+        {
+          for (int byte = 0; byte < 4; byte++)
+            sse[mask][4 * n + byte] = 4 * lane + byte;
+          n++;
+        }
+      for (; n < 4; n++)
+        for (int byte = 0; byte < 4; byte++)
+          sse[mask][4 * n + byte] = 0x80;
+    }
+
+    for (int mask = 0; mask < 256; mask++)
+    {
+      int n = 0;
+      for (int lane = 0; lane < 8; lane++)
+        if (mask & (1 << lane))
+          avx2[mask][n++] = lane;
+      for (; n < 8; n++)
+        avx2[mask][n] = 0;
+    }
+  }
+
+  uint8_t sse[16][16];
+  uint32_t avx2[256][8];
+};
+
+const ShuffleTables tables;
+
+} // namespace
+
+// The block kernels store a full register of packed matches at out + k, which may write past
+// the last match.  That is only done where it can't clobber anything still needed: inside the
+// caller's buffer and, for in-place use, only over ids of a that have been consumed, i.e. before
+// the current block or inside it once it is done.  Elsewhere the matches go through a
+// temporary.  Writing just the matches in place is always safe: it only replaces lanes holding
+// ids no larger than the matches, which can't match any later block of b.
+
+__attribute__((target("sse4.1"))) size_t
+intersectSSE(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  size_t cap = std::min(na, nb);
+  bool inplace = out == a;
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+  while (i + 4 <= na && j + 4 <= nb)
+  {
+    int amax = a[i + 3];
+    int bmax = b[j + 3];
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+
+    // compare every lane of va against every lane of vb by rotating vb.
+    __m128i eq = _mm_cmpeq_epi32(va, vb);
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+    if (mask != 0)
+    {
+      __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.sse[mask]));
+      __m128i packed = _mm_shuffle_epi8(va, shuffle);
+      int n = __builtin_popcount(mask);
+      if (k + 4 <= cap && (!inplace || (amax <= bmax && k <= i) || k + 4 <= i))
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k), packed);
+      else
+      {
+        int tmp[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(tmp), packed);
+        std::copy(tmp, tmp + n, out + k);
+      }
+      k += n;
+    }
+
+    if (amax <= bmax)
+      i += 4;
+    if (bmax <= amax)
+      j += 4;
+  }
+  return k + intersectScalar(a + i, na - i, b + j, nb - j, out + k);
+}
+
+__attribute__((target("avx2"))) size_t
+intersectAVX2(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  size_t cap = std::min(na, nb);
+  bool inplace = out == a;
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+  const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+  while (i + 8 <= na && j + 8 <= nb)
+  {
+    int amax = a[i + 7];
+    int bmax = b[j + 7];
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+
+    __m256i eq = _mm256_cmpeq_epi32(va, vb);
+    for (int r = 1; r < 8; r++)
+    {
+      vb = _mm256_permutevar8x32_epi32(vb, rotate);
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+    }
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+    if (mask != 0)
+    {
+      __m256i shuffle = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tables.avx2[mask]));
+      __m256i packed = _mm256_permutevar8x32_epi32(va, shuffle);
+      int n = __builtin_popcount(mask);
+      if (k + 8 <= cap && (!inplace || (amax <= bmax && k <= i) || k + 8 <= i))
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + k), packed);
+      else
+      {
+        int tmp[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(tmp), packed);
+        std::copy(tmp, tmp + n, out + k);
+      }
+      k += n;
+    }
+
+    if (amax <= bmax)
+      i += 8;
+    if (bmax <= amax)
+      j += 8;
+  }
+  return k + intersectScalar(a + i, na - i, b + j, nb - j, out + k);
+}
+
+bool
+haveSSE()
+{
+  return __builtin_cpu_supports("sse4.1");
+}
+
+bool
+haveAVX2()
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+size_t
+intersectSSE(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  return intersectScalar(a, na, b, nb, out);
+}
+
+size_t
+intersectAVX2(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  return intersectScalar(a, na, b, nb, out);
+}
+
+bool
+haveSSE()
+{
+  return false;
+}
+
+bool
+haveAVX2()
+{
+  return false;
+}
+
+#endif
+
+size_t
+intersectSorted(const int * a, size_t na, const int * b, size_t nb, int * out)
+{
+  typedef size_t (*Kernel)(const int *, size_t, const int *, size_t, int *);
+  static const Kernel block = haveAVX2() ? intersectAVX2 : haveSSE() ? intersectSSE : intersectScalar;
+
+  // galloping only ever writes a match at or before the position it was found at in either list,
+  // so searching a for the ids of b is still safe when out is a.
+  if (na > gallop_ratio * nb)
+    return intersectGallop(b, nb, a, na, out);
+  if (nb > gallop_ratio * na)
+    return intersectGallop(a, na, b, nb, out);
+  return block(a, na, b, nb, out);
+}
@@ -0,0 +1,27 @@
+#ifndef INTERSECT_H_
+#define INTERSECT_H_
+
+#include <cstddef>
+
+// Kernels for intersecting sorted lists of unique ids.  Each takes lists a and b and writes the
+// ids found in both to out, which must have room for min(na, nb) ids and may be a itself (an
+// in-place intersection); they return the number of ids written.
+//
+// The block kernels compare a block of 4 (SSE) or 8 (AVX2) ids from each list at once and suit
+// lists of similar length.  Galloping search walks the shorter list and seeks each of its ids in
+// the longer one with an exponential then binary search, which suits lists of very different
+// lengths.
+
+size_t intersectScalar(const int * a, size_t na, const int * b, size_t nb, int * out);
+size_t intersectGallop(const int * a, size_t na, const int * b, size_t nb, int * out);
+size_t intersectSSE(const int * a, size_t na, const int * b, size_t nb, int * out);
+size_t intersectAVX2(const int * a, size_t na, const int * b, size_t nb, int * out);
+
+// returns false if the running CPU can't run intersectSSE or intersectAVX2 respectively.
+bool haveSSE();
+bool haveAVX2();
+
+// intersectSorted picks the best kernel for the given list lengths and the running CPU.
+size_t intersectSorted(const int * a, size_t na, const int * b, size_t nb, int * out);
+
+#endif // INTERSECT_H_
@@ -1,12 +1,27 @@
 
+#include "bitmap.h"
+#include "epoch.h"
+#include "intersect.h"
 #include "sqlite_db.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <list>
 #include <map>
+#include <mutex>
+#include <numeric>
 #include <random>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <memory>
 
@@ -17,10 +32,18 @@ public:
   std::string system;
   bool enabled = true;
 
+  // objects that act on every boundary or subdomain set these instead of listing all of them.
+  bool all_boundaries = false;
+  bool all_subdomains = false;
   std::vector<int> boundaries;
   std::vector<int> subdomains;
   std::vector<std::string> tags;
   std::vector<int> execute_ons;
+
+private:
+  friend class Warehouse;
+  // the object's id in the Warehouse holding it.
+  int _id = -1;
 };
 
 // attributes include:
@@ -44,9 +67,60 @@ enum class AttributeId
   ExecOn,    // multiple
 };
 
+// SymbolTable assigns dense integer ids to strings.  System and tag values are interned once when
+// objects and queries enter a Warehouse so that stores only ever store and compare integers.  The
+// table is shared by all warehouses, which threads may use at the same time, so every method
+// takes the table's lock.
+class SymbolTable
+{
+public:
+  // returns the id of s, assigning it the next free id if s hasn't been seen before.
+  int intern(const std::string & s)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _ids.find(s);
+    if (it != _ids.end())
+      return it->second;
+    _names.push_back(s);
+    return _ids[s] = _names.size() - 1;
+  }
+
+  // returns the id of s, or -1 if s hasn't been interned.
+  int find(const std::string & s) const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _ids.find(s);
+    return it == _ids.end() ? -1 : it->second;
+  }
+
+  // returns the string with the given id.  Names never move once interned, so the reference
+  // stays valid while others are added.
+  const std::string & name(int id) const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _names[id];
+  }
+
+private:
+  mutable std::mutex _mutex;
+  std::unordered_map<std::string, int> _ids;
+  std::deque<std::string> _names;
+};
+
+// symbols returns the process wide symbol table for string attribute values.
+SymbolTable &
+symbols()
+{
+  static SymbolTable table;
+  return table;
+}
+
 class Storage
 {
 public:
+  // Attribute is one attribute value of an object or, in a query, one condition that an object's
+  // attribute must match.  Callers of Warehouse give System and Tag values as strvalue; the
+  // Warehouse interns them into value, and stores only ever look at value.
   struct Attribute
   {
     AttributeId id;
@@ -58,529 +132,5815 @@ public:
     }
   };
 
+  // an object attribute with this value applies to every value of the attribute, i.e. it stands
+  // for "all boundaries" or "all subdomains" (the only attributes that support it).  Stores keep
+  // it once per object and merge such objects into the results of every condition on the
+  // attribute.
+  static const int wildcard = std::numeric_limits<int>::min();
+
+  static bool supportsWildcard(AttributeId id)
+  {
+    return id == AttributeId::Boundary || id == AttributeId::Subdomain;
+  }
+
+  // SetOp says how set changes an attribute: Replace gives a single-valued attribute (thread,
+  // system or enabled) a new value while Insert and Erase add or remove one value of a
+  // multi-valued attribute.  Inserting or erasing the wildcard sets or clears the object's "all"
+  // flag for the attribute.
+  enum class SetOp
+  {
+    Replace,
+    Insert,
+    Erase,
+  };
+
+  // Change reports what a set call did: changed is false if the object already was in the
+  // requested state, and old is the previous value of a replaced attribute.
+  struct Change
+  {
+    bool changed;
+    int old;
+  };
+
+  static bool isMultiValued(AttributeId id) { return id >= AttributeId::Tag && id <= AttributeId::ExecOn; }
+
+  // throws if op doesn't apply to attrib's attribute.
+  static void checkSetOp(const Attribute & attrib, SetOp op)
+  {
+    if (attrib.id == AttributeId::None || attrib.id > AttributeId::ExecOn)
+      throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(attrib.id)));
+    if ((op == SetOp::Replace) == isMultiValued(attrib.id))
+      throw std::runtime_error(op == SetOp::Replace ? "can't replace a multi-valued attribute"
+                                                    : "can't insert or erase a single-valued attribute");
+    if (attrib.value == wildcard && !supportsWildcard(attrib.id))
+      throw std::runtime_error("attribute " + std::to_string(static_cast<int>(attrib.id)) + " has no wildcard");
+  }
+
+  // Batch holds the attributes of a run of objects back to back; the attributes of its i-th
+  // object are (*this)[i].  Its entries only carry what stores look at, the interned values.
+  struct Batch
+  {
+    struct Entry
+    {
+      AttributeId id;
+      int value;
+    };
+
+    struct Row
+    {
+      const Entry * first;
+      const Entry * last;
+      const Entry * begin() const { return first; }
+      const Entry * end() const { return last; }
+    };
+
+    std::vector<Entry> attribs;
+    std::vector<uint32_t> offsets = {0};
+
+    // closes the attributes appended to attribs since the last call as the next object.
+    void endObject() { offsets.push_back(attribs.size()); }
+    size_t size() const { return offsets.size() - 1; }
+    void clear()
+    {
+      attribs.clear();
+      offsets.resize(1);
+    }
+    Row operator[](size_t i) const
+    {
+      return {attribs.data() + offsets[i], attribs.data() + offsets[i + 1]};
+    }
+  };
+
+  virtual ~Storage() {}
+
+  // lets the store spread bulk work such as loading a batch over the threads of pool; without a
+  // pool (the default) everything runs on the calling thread.
+  void setThreadPool(ThreadPool * pool) { _pool = pool; }
+  ThreadPool * threadPool() const { return _pool; }
+
   virtual void add(int obj_id, const std::vector<Attribute> & attribs) = 0;
+  // adds the objects of batch with the ids first_id, first_id + 1, ...  Stores override it to
+  // load a batch in one pass; the default adds one object at a time.
+  virtual void addBatch(int first_id, const Batch & batch)
+  {
+    std::vector<Attribute> attribs;
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      attribs.clear();
+      for (auto & entry : batch[i])
+        attribs.push_back({entry.id, entry.value, ""});
+      add(first_id + i, attribs);
+    }
+  }
   virtual std::vector<int> query(const std::vector<Attribute> & conds) = 0;
-  virtual void set(int obj_id, const Attribute & attrib) = 0;
+
+  // return the number of objects query(conds) would return and whether there are any.  Stores
+  // override them to count without building the list of ids, and any to stop at the first
+  // match; by default they run query.
+  virtual size_t count(const std::vector<Attribute> & conds) { return query(conds).size(); }
+  virtual bool any(const std::vector<Attribute> & conds) { return !query(conds).empty(); }
+
+  // returns the first limit objects, i.e. those with the lowest ids, that query(conds) would
+  // return.  Stores override it to stop looking once they have found them, so that it costs in
+  // proportion to limit rather than to the number of objects; by default it runs query.
+  virtual std::vector<int> first(const std::vector<Attribute> & conds, size_t limit)
+  {
+    auto objs = query(conds);
+    std::sort(objs.begin(), objs.end());
+    objs.resize(std::min(objs.size(), limit));
+    return objs;
+  }
+
+  // Prepared is a condition list that a store has readied for being queried repeatedly.
+  class Prepared
+  {
+  public:
+    explicit Prepared(const std::vector<Attribute> & conds) : conds(conds) {}
+    virtual ~Prepared() {}
+
+    const std::vector<Attribute> conds;
+  };
+
+  // prepares conds for run.  Stores that can do better than interpreting the conditions on
+  // every query return a Prepared subclass of their own; by default run just calls query.
+  virtual std::unique_ptr<Prepared> prepare(const std::vector<Attribute> & conds)
+  {
+    return std::unique_ptr<Prepared>(new Prepared(conds));
+  }
+  // replaces the contents of objs with the results of prepared.  objs belongs to the caller and
+  // keeps its memory: stores collect the ids in scratch buffers of their own and copy them over,
+  // so running a query again allocates nothing unless it has more results than ever before.
+  // Because of those buffers a store runs one query at a time; callers on several threads have
+  // to take turns, like they do under Warehouse's lock.
+  virtual void run(const Prepared & prepared, std::vector<int> & objs) { objs = query(prepared.conds); }
+  // return the number of results of prepared and whether it has any, like count and any.  Stores
+  // override them to reuse what prepare worked out and scratch buffers of their own, so that
+  // counting a prepared query again allocates nothing; by default they call count and any.
+  virtual size_t runCount(const Prepared & prepared) { return count(prepared.conds); }
+  virtual bool runAny(const Prepared & prepared) { return any(prepared.conds); }
+  // brings prepared up to date with the store, e.g. plans it again once the statistics it was
+  // planned with have drifted.  run and open only read prepared, so it is up to whoever changes
+  // the store to call this between runs; by default there is nothing to do.
+  virtual void replan(Prepared &) {}
+
+  // Cursor hands out the results of a query batch by batch, in the order query returns them.
+  // The store and the prepared query must stay alive and unchanged while a cursor is in use.
+  class Cursor
+  {
+  public:
+    virtual ~Cursor() {}
+    // replaces the contents of batch with the next results, reusing its memory; returns false,
+    // with batch empty, once all results have been handed out.
+    virtual bool next(std::vector<int> & batch) = 0;
+  };
+
+  // opens a cursor over the results of prepared.  Stores that find their results in order
+  // stream them, so that callers can start on the first batch before the rest is found; by
+  // default the cursor runs the whole query up front.
+  virtual std::unique_ptr<Cursor> open(const Prepared & prepared)
+  {
+    std::unique_ptr<ResultsCursor> cursor(new ResultsCursor);
+    run(prepared, cursor->results);
+    return cursor;
+  }
+
+  // returns the results of all of queries.  Stores that can share work between the queries
+  // override it; the default runs them one by one.
+  virtual std::vector<std::vector<int>> queryAll(const std::vector<std::vector<Attribute>> & queries)
+  {
+    std::vector<std::vector<int>> results;
+    for (auto & conds : queries)
+      results.push_back(query(conds));
+    return results;
+  }
+  // changes one attribute of object obj_id in place, updating the store's per-value indexes
+  // rather than rebuilding them.
+  virtual Change set(int obj_id, const Attribute & attrib, SetOp op = SetOp::Replace) = 0;
+
+  // removes object obj_id: it no longer matches any query, but its id stays taken (as a
+  // tombstone) until the next compact.
+  virtual void remove(int obj_id) = 0;
+
+  // reclaims the space of the removed objects and renumbers the others to 0, 1, 2, ... keeping
+  // their order, i.e. an object's new id is its old one less the number of removed ids below it.
+  virtual void compact() = 0;
+
+  // estimates the number of objects query(conds) returns from the number of objects matching
+  // each condition by itself, assuming that conditions on different values are independent.  It
+  // doesn't look at any object, so it takes microseconds however many objects the store holds.
+  double estimate(const std::vector<Attribute> & conds) const
+  {
+    double n = liveObjects();
+    if (n <= 0)
+      return 0;
+    double est = n;
+    for (size_t i = 0; i < conds.size(); i++)
+    {
+      bool repeated = false;
+      for (size_t j = 0; j < i; j++)
+      {
+        if (conds[j].id != conds[i].id)
+          continue;
+        if (conds[j].value == conds[i].value)
+          repeated = true;
+        else if (!isMultiValued(conds[i].id))
+          return 0; // no object has two values of a single-valued attribute
+      }
+      if (!repeated)
+        est *= std::min(1.0, matches(conds[i]) / n);
+    }
+    return est;
+  }
+
+  // the statistics behind estimate: the number of live objects and the number of those that
+  // match cond alone (including the objects with the attribute's wildcard).  Stores answer both
+  // from per-value counts or list sizes without touching the objects, so matches may be
+  // approximate, e.g. while removed objects still take up room in the lists.
+  virtual long liveObjects() const = 0;
+  virtual long matches(const Attribute & cond) const = 0;
+
+protected:
+  // batches smaller than this aren't worth splitting over threads.
+  static const size_t min_parallel_batch = 4096;
+  // cursors hand out about this many ids per batch.
+  static const size_t cursor_batch = 4096;
+
+  // the default cursor, over results found in advance.
+  struct ResultsCursor : public Cursor
+  {
+    virtual bool next(std::vector<int> & batch) override
+    {
+      size_t n = std::min(cursor_batch, results.size() - pos);
+      batch.assign(results.begin() + pos, results.begin() + pos + n);
+      pos += n;
+      return n > 0;
+    }
+
+    std::vector<int> results;
+    size_t pos = 0;
+  };
+
+  bool parallel(const Batch & batch) const
+  {
+    return _pool && _pool->size() > 1 && batch.size() >= min_parallel_batch;
+  }
+
+  ThreadPool * _pool = nullptr;
 };
 
-class VecStore : public Storage
+const int Storage::wildcard;
+const size_t Storage::cursor_batch;
+
+// Tombstones marks the ids of a store's removed objects until the next compaction.
+class Tombstones
 {
 public:
-  virtual void add(int obj_id, const std::vector<Attribute> & attribs) override
+  // makes room for the ids up to n - 1.
+  void resize(int n) { _removed.resize(n, false); }
+
+  bool operator[](int id) const { return _removed[id]; }
+  int size() const { return _removed.size(); }
+  int count() const { return _count; }
+
+  // marks id removed; returns false if it already was.
+  bool remove(int id)
   {
-    if (obj_id < _system.size())
-      throw std::runtime_error("object with id " + std::to_string(obj_id) + " already added");
+    if (_removed[id])
+      return false;
+    _removed[id] = true;
+    _count++;
+    return true;
+  }
 
-    _system.push_back("");
-    _thread.push_back(-1);
-    _enabled.push_back(true);
-    _tags.push_back({});
-    _boundaries.push_back({});
-    _subdomains.push_back({});
-    _execute_ons.push_back({});
+  // drops the removed ids from ids.
+  void filter(std::vector<int> & ids) const
+  {
+    if (_count == 0)
+      return;
+    size_t n = 0;
+    for (auto id : ids)
+      if (!_removed[id])
+        ids[n++] = id;
+    ids.resize(n);
+  }
 
-    for (auto & attrib : attribs)
+  // returns the id each id gets when the removed ones are dropped (-1 for those) and clears the
+  // marks for the renumbered ids.
+  std::vector<int> renumber()
+  {
+    std::vector<int> new_ids(_removed.size(), -1);
+    int n = 0;
+    for (size_t i = 0; i < _removed.size(); i++)
+      if (!_removed[i])
+        new_ids[i] = n++;
+    _removed.assign(n, false);
+    _removed.shrink_to_fit();
+    _count = 0;
+    return new_ids;
+  }
+
+private:
+  std::vector<bool> _removed;
+  int _count = 0;
+};
+
+// ValueCounts counts the occurrences of every attribute value among the objects of a store, as
+// selectivity statistics for planning queries.  Most values are small integers and are counted
+// in a table indexed by value; others, like the wildcard, in a hash map.
+class ValueCounts
+{
+public:
+  void add(AttributeId id, int value, int n = 1)
+  {
+    int a = static_cast<int>(id);
+    _totals[a] += n;
+    auto & table = _tables[a];
+    if (value >= 0 && value < max_table)
     {
-      switch (attrib.id)
-      {
-        case AttributeId::Thread:
-          _thread.back() = attrib.value;
-          break;
-        case AttributeId::System:
-          _system.back() = attrib.strvalue;
-          break;
-        case AttributeId::Enabled:
-          _enabled.back() = attrib.value;
-          break;
-        case AttributeId::Boundary:
-          _boundaries.back().push_back(attrib.value);
-          break;
-        case AttributeId::Subdomain:
-          _subdomains.back().push_back(attrib.value);
-          break;
-        case AttributeId::ExecOn:
-          _execute_ons.back().push_back(attrib.value);
-          break;
-        case AttributeId::Tag:
-          _tags.back().push_back(attrib.strvalue);
-          break;
-        default:
-          throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(attrib.id)));
-      }
+      if (value >= table.size())
+        table.resize(std::max(size_t(value) + 1, 2 * table.size()), 0);
+      table[value] += n;
+    }
+    else
+      _others[a][value] += n;
+  }
+
+  void remove(AttributeId id, int value, int n = 1) { add(id, value, -n); }
+
+  // the number of occurrences of the value.
+  long count(AttributeId id, int value) const
+  {
+    int a = static_cast<int>(id);
+    auto & table = _tables[a];
+    if (value >= 0 && value < max_table)
+      return value < table.size() ? table[value] : 0;
+    auto it = _others[a].find(value);
+    return it == _others[a].end() ? 0 : it->second;
+  }
+
+  // the number of occurrences of all values of the attribute.
+  long total(AttributeId id) const { return _totals[static_cast<int>(id)]; }
+
+private:
+  static const int nattribs = static_cast<int>(AttributeId::ExecOn) + 1;
+  static const int max_table = 1 << 20;
+
+  std::vector<long> _tables[nattribs];
+  std::unordered_map<int, long> _others[nattribs];
+  long _totals[nattribs] = {};
+};
+
+// dropRemoved drops the entries of v whose new id (see Tombstones::renumber) is -1.
+template <typename T>
+void
+dropRemoved(std::vector<T> & v, const std::vector<int> & new_ids)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < v.size(); i++)
+    if (new_ids[i] >= 0)
+      v[n++] = v[i];
+  v.resize(n);
+  v.shrink_to_fit();
+}
+
+// reserveFor makes room for n elements in v in one step, growing it at least geometrically so
+// that a sequence of batches doesn't reallocate for every batch.
+template <typename T>
+void
+reserveFor(std::vector<T> & v, size_t n)
+{
+  if (v.capacity() < n)
+    v.reserve(std::max(n, 2 * v.capacity()));
+}
+
+// Csr stores a list of values for each of a sequence of rows in compressed sparse row form: the
+// values of all rows back to back in one array plus the offset of each row's first value.  Rows
+// are appended one at a time by pushing their values and then closing the row with endRow.
+//
+// Every row keeps its values at the front of its slots and counts them; values erased from a row
+// later leave free slots at its end that a later insert into the row reuses.  An insert into a
+// full row moves the row to the end of the array with twice the slots, so it costs in proportion
+// to the row rather than to the whole array.  The slots moved rows leave behind are reclaimed by
+// packing the rows again once they make up half the array.
+template <typename T>
+class Csr
+{
+public:
+  struct Row
+  {
+    const T * first;
+    const T * last;
+    const T * begin() const { return first; }
+    const T * end() const { return last; }
+  };
+
+  // appends v to the row that the next endRow call closes.
+  void push(const T & v) { _values.push_back(v); }
+  void endRow()
+  {
+    _offsets.push_back(_open);
+    _sizes.push_back(_values.size() - _open);
+    _slots.push_back(_sizes.back());
+    _open = _values.size();
+  }
+
+  size_t rows() const { return _sizes.size(); }
+  Row operator[](size_t i) const
+  {
+    auto first = _values.data() + _offsets[i];
+    return {first, first + _sizes[i]};
+  }
+
+  bool contains(size_t i, const T & v) const
+  {
+    auto row = (*this)[i];
+    return std::find(row.begin(), row.end(), v) != row.end();
+  }
+
+  // adds v to row i.  Like erase, it must not be called while a row is being pushed.
+  void insert(size_t i, const T & v)
+  {
+    if (_sizes[i] == _slots[i])
+      relocate(i);
+    _values[_offsets[i] + _sizes[i]++] = v;
+  }
+
+  // removes every copy of v from row i; returns false if there was none.
+  bool erase(size_t i, const T & v)
+  {
+    auto first = _values.begin() + _offsets[i];
+    auto last = first + _sizes[i];
+    auto kept = std::remove(first, last, v);
+    _sizes[i] = kept - first;
+    return kept != last;
+  }
+
+  // drops the rows whose new id (see Tombstones::renumber) is -1 and the free slots of the
+  // others.
+  void compact(const std::vector<int> & new_ids)
+  {
+    Csr kept;
+    for (size_t i = 0; i < rows(); i++)
+    {
+      if (new_ids[i] < 0)
+        continue;
+      for (auto & v : (*this)[i])
+        kept.push(v);
+      kept.endRow();
     }
+    kept._values.shrink_to_fit();
+    kept._offsets.shrink_to_fit();
+    kept._sizes.shrink_to_fit();
+    kept._slots.shrink_to_fit();
+    *this = std::move(kept);
+  }
+
+private:
+  static const size_t spare = 4;
+
+  // moves the full row i to the end of the array, giving it free slots for the next inserts.
+  void relocate(size_t i)
+  {
+    if (_moved > _values.size() / 2)
+      repack();
+    size_t n = _sizes[i];
+    size_t first = _values.size();
+    _values.resize(first + std::max(2 * n, n + spare));
+    std::copy(_values.begin() + _offsets[i], _values.begin() + _offsets[i] + n, _values.begin() + first);
+    _moved += _slots[i];
+    _offsets[i] = first;
+    _slots[i] = _values.size() - first;
+    _open = _values.size();
+  }
+
+  // copies the rows back to back in order, leaving out the slots moved rows left behind.
+  void repack()
+  {
+    std::vector<T> values;
+    values.reserve(_values.size() - _moved);
+    for (size_t i = 0; i < rows(); i++)
+    {
+      auto first = _values.begin() + _offsets[i];
+      _offsets[i] = values.size();
+      values.insert(values.end(), first, first + _slots[i]);
+    }
+    _values = std::move(values);
+    _moved = 0;
+    _open = _values.size();
+  }
+
+  std::vector<T> _values;
+  // the first slot, the number of values and the number of slots of each row; the slots after
+  // the values are free.  Rows are in order in _values until insert moves one to the end.
+  std::vector<uint32_t> _offsets;
+  std::vector<uint32_t> _sizes;
+  std::vector<uint32_t> _slots;
+  // the offset of the row being pushed, and the number of slots no row uses since it was moved.
+  size_t _open = 0;
+  size_t _moved = 0;
+};
+
+class VecStore : public Storage
+{
+public:
+  virtual void add(int obj_id, const std::vector<Attribute> & attribs) override { append(obj_id, attribs); }
+
+  virtual void addBatch(int first_id, const Batch & batch) override
+  {
+    size_t n = _system.size() + batch.size();
+    reserveFor(_system, n);
+    reserveFor(_thread, n);
+    reserveFor(_enabled, n);
+    reserveFor(_all_boundaries, n);
+    reserveFor(_all_subdomains, n);
+    for (size_t i = 0; i < batch.size(); i++)
+      append(first_id + i, batch[i]);
   }
 
+  // tests the conditions in the order plan puts them in.
   virtual std::vector<int> query(const std::vector<Attribute> & conds) override
   {
+    auto planned = plan(conds);
     std::vector<int> objs;
+    scanChunks([&](int begin, int end, std::vector<int> & objs) { scan(planned, begin, end, objs); }, objs);
+    return objs;
+  }
+
+  // scans like query, in parallel chunks with a count each.
+  virtual size_t count(const std::vector<Attribute> & conds) override
+  {
+    auto planned = plan(conds);
+    auto countRange = [&](int begin, int end) {
+      size_t n = 0;
+      for (int i = begin; i < end; i++)
+        if (!_removed[i] && matchesAll(i, planned))
+          n++;
+      return n;
+    };
+    int n = _system.size();
+    if (!_pool || _pool->size() == 1 || n < min_parallel_scan)
+      return countRange(0, n);
+
+    int nchunks = (n + scan_chunk - 1) / scan_chunk;
+    std::vector<size_t> counts(nchunks);
+    _pool->run(nchunks, [&](int c) { counts[c] = countRange(c * scan_chunk, std::min(n, (c + 1) * scan_chunk)); });
+    return std::accumulate(counts.begin(), counts.end(), size_t(0));
+  }
+
+  // scans on one thread, which beats waiting for the other chunks once a match is found.
+  virtual bool any(const std::vector<Attribute> & conds) override
+  {
+    auto planned = plan(conds);
     for (int i = 0; i < _system.size(); i++)
+      if (!_removed[i] && matchesAll(i, planned))
+        return true;
+    return false;
+  }
+
+  // scans on one thread like any, up to the limit-th match.
+  virtual std::vector<int> first(const std::vector<Attribute> & conds, size_t limit) override
+  {
+    auto planned = plan(conds);
+    std::vector<int> objs;
+    for (int i = 0; i < _system.size() && objs.size() < limit; i++)
+      if (!_removed[i] && matchesAll(i, planned))
+        objs.push_back(i);
+    return objs;
+  }
+
+  // compiles conds into a scan specialized for the attributes they test (see Compiled).
+  virtual std::unique_ptr<Prepared> prepare(const std::vector<Attribute> & conds) override
+  {
+    std::unique_ptr<Compiled> c(new Compiled(conds));
+    std::vector<int> single(nattribs, -1);
+    for (auto & cond : conds)
     {
-      bool passes = true;
-      for (auto & cond : conds)
+      int a = static_cast<int>(cond.id);
+      if (cond.id == AttributeId::None || a >= nattribs)
+        throw std::runtime_error("unknown AttributeId " + std::to_string(a));
+      if (!isMultiValued(cond.id))
       {
-        switch (cond.id)
-        {
-          case AttributeId::Thread:
-            passes = cond.value == _thread[i];
-            break;
-          case AttributeId::System:
-            passes = cond.strvalue == _system[i];
-            break;
-          case AttributeId::Enabled:
-            passes = cond.value == _enabled[i];
-            break;
-          case AttributeId::Boundary:
-            passes = false;
-            for (auto val : _boundaries[i])
-              if (cond.value == val)
-              {
-                passes = true;
-                break;
-              }
-            break;
-          case AttributeId::Subdomain:
-            passes = false;
-            for (auto val : _subdomains[i])
-              if (cond.value == val)
-              {
-                passes = true;
-                break;
-              }
-            break;
-          case AttributeId::ExecOn:
-            passes = false;
-            for (auto val : _execute_ons[i])
-              if (cond.value == val)
-              {
-                passes = true;
-                break;
-              }
-            break;
-          case AttributeId::Tag:
-            passes = false;
-            for (auto & val : _tags[i])
-              if (cond.strvalue == val)
-              {
-                passes = true;
-                break;
-              }
-            break;
-          default:
-            throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(cond.id)));
-        }
-        if (!passes)
-          break;
+        if (single[a] >= 0 && single[a] != cond.value)
+          c->none = true;
+        single[a] = cond.value;
       }
-      if (passes)
-        objs.push_back(i);
     }
-    return objs;
+    compile(*c);
+    return c;
+  }
+
+  virtual void run(const Prepared & prepared, std::vector<int> & objs) override
+  {
+    auto & c = dynamic_cast<const Compiled &>(prepared);
+    if (c.none)
+    {
+      objs.clear();
+      return;
+    }
+    scanChunks([&](int begin, int end, std::vector<int> & objs) { c.scan(*this, c, begin, end, objs); }, objs);
+  }
+
+  // adds up the ids the chunks of the compiled scan found, without copying them anywhere.
+  virtual size_t runCount(const Prepared & prepared) override
+  {
+    auto & c = dynamic_cast<const Compiled &>(prepared);
+    if (c.none)
+      return 0;
+    int nchunks = scanParts([&](int begin, int end, std::vector<int> & objs) { c.scan(*this, c, begin, end, objs); });
+    size_t n = 0;
+    for (int i = 0; i < nchunks; i++)
+      n += _chunks[i].size();
+    return n;
+  }
+
+  // runs the compiled scan chunk by chunk on the calling thread, up to the first chunk with a
+  // match.
+  virtual bool runAny(const Prepared & prepared) override
+  {
+    auto & c = dynamic_cast<const Compiled &>(prepared);
+    if (c.none)
+      return false;
+    if (_chunks.empty())
+      _chunks.resize(1);
+    int n = _system.size();
+    for (int begin = 0; begin < n; begin += scan_chunk)
+    {
+      _chunks[0].clear();
+      c.scan(*this, c, begin, std::min(n, begin + scan_chunk), _chunks[0]);
+      if (!_chunks[0].empty())
+        return true;
+    }
+    return false;
+  }
+
+  // streams the compiled scan chunk by chunk on the calling thread.
+  virtual std::unique_ptr<Cursor> open(const Prepared & prepared) override
+  {
+    auto & c = dynamic_cast<const Compiled &>(prepared);
+    return std::unique_ptr<Cursor>(new ScanCursor(*this, c));
+  }
+
+  // compiled queries are planned again when the statistics they were planned with have drifted.
+  virtual void replan(Prepared & prepared) override
+  {
+    auto & c = dynamic_cast<Compiled &>(prepared);
+    if (!c.none && drifted(c))
+      compile(c);
+  }
+
+  // evaluates all of queries in a single pass over the columns, chunk by chunk.  For every chunk
+  // each distinct condition of all the queries gets a bitset of the objects matching it, filled
+  // in one pass over the condition's attribute column for all conditions on that attribute
+  // together.  The queries then only AND the bitsets of their conditions.
+  virtual std::vector<std::vector<int>> queryAll(const std::vector<std::vector<Attribute>> & queries) override
+  {
+    SharedConds shared(queries);
+    int n = _system.size();
+    int nchunks = (n + scan_chunk - 1) / scan_chunk;
+    std::vector<std::vector<std::vector<int>>> parts(nchunks);
+    auto scanChunk = [&](int c) {
+      parts[c].resize(queries.size());
+      scanShared(shared, c * scan_chunk, std::min(n, (c + 1) * scan_chunk), parts[c]);
+    };
+    if (_pool && _pool->size() > 1 && n >= min_parallel_scan)
+      _pool->run(nchunks, scanChunk);
+    else
+      for (int c = 0; c < nchunks; c++)
+        scanChunk(c);
+
+    std::vector<std::vector<int>> results(queries.size());
+    for (size_t q = 0; q < queries.size(); q++)
+      for (auto & part : parts)
+        results[q].insert(results[q].end(), part[q].begin(), part[q].end());
+    return results;
+  }
+
+  virtual Change set(int obj_id, const Attribute & attrib, SetOp op) override
+  {
+    if (obj_id >= _system.size() || _removed[obj_id])
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+    checkSetOp(attrib, op);
+
+    switch (attrib.id)
+    {
+      case AttributeId::Thread:
+        return replace(AttributeId::Thread, _thread[obj_id], attrib.value);
+      case AttributeId::System:
+        return replace(AttributeId::System, _system[obj_id], attrib.value);
+      case AttributeId::Enabled:
+      {
+        bool old = _enabled[obj_id];
+        _enabled[obj_id] = attrib.value;
+        _counts.remove(AttributeId::Enabled, old);
+        _counts.add(AttributeId::Enabled, _enabled[obj_id]);
+        return {old != bool(attrib.value), old};
+      }
+      case AttributeId::Boundary:
+        return update(attrib.id, _boundaries, _all_boundaries, obj_id, attrib.value, op);
+      case AttributeId::Subdomain:
+        return update(attrib.id, _subdomains, _all_subdomains, obj_id, attrib.value, op);
+      case AttributeId::ExecOn:
+        return update(attrib.id, _execute_ons, obj_id, attrib.value, op);
+      default:
+        return update(attrib.id, _tags, obj_id, attrib.value, op);
+    }
+  }
+
+  virtual void remove(int obj_id) override
+  {
+    if (obj_id >= _system.size() || !_removed.remove(obj_id))
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+
+    _counts.remove(AttributeId::Thread, _thread[obj_id]);
+    _counts.remove(AttributeId::System, _system[obj_id]);
+    _counts.remove(AttributeId::Enabled, _enabled[obj_id]);
+    if (_all_boundaries[obj_id])
+      _counts.remove(AttributeId::Boundary, wildcard);
+    if (_all_subdomains[obj_id])
+      _counts.remove(AttributeId::Subdomain, wildcard);
+    countLists(obj_id, -1);
+  }
+
+  virtual void compact() override
+  {
+    auto new_ids = _removed.renumber();
+    dropRemoved(_system, new_ids);
+    dropRemoved(_thread, new_ids);
+    dropRemoved(_enabled, new_ids);
+    dropRemoved(_all_boundaries, new_ids);
+    dropRemoved(_all_subdomains, new_ids);
+    _tags.compact(new_ids);
+    _boundaries.compact(new_ids);
+    _subdomains.compact(new_ids);
+    _execute_ons.compact(new_ids);
+  }
+
+  virtual long liveObjects() const override { return long(_system.size()) - _removed.count(); }
+
+  // from _counts, which also guide the query plans.
+  virtual long matches(const Attribute & cond) const override
+  {
+    long n = _counts.count(cond.id, cond.value);
+    if (supportsWildcard(cond.id) && cond.value != wildcard)
+      n += _counts.count(cond.id, wildcard);
+    return n;
+  }
+
+private:
+  // scans need at least this many objects to run in parallel; they do so in chunks of
+  // scan_chunk objects, whose columns take up a few hundred kB and so stay in a core's cache.
+  static const int min_parallel_scan = 65536;
+  static const int scan_chunk = 16384;
+
+  static const int nattribs = static_cast<int>(AttributeId::ExecOn) + 1;
+
+  // calls scan(begin, end, ids) to collect the matching objects of all ids in the first chunks
+  // of _chunks and returns how many chunks there are.  Large scans are split into chunks that the
+  // pool's threads take one at a time, so a thread that is done with its chunks takes over the
+  // remaining ones of slower threads.  _chunks keep their memory from scan to scan, so that
+  // scanning allocates nothing once they have grown to the sizes of the results.
+  template <typename Scan>
+  int scanParts(Scan scan)
+  {
+    int n = _system.size();
+    int nchunks = 1;
+    if (_pool && _pool->size() > 1 && n >= min_parallel_scan)
+      nchunks = (n + scan_chunk - 1) / scan_chunk;
+    if (_chunks.size() < size_t(nchunks))
+      _chunks.resize(nchunks);
+    auto scanChunk = [&](int c) {
+      _chunks[c].clear();
+      scan(nchunks == 1 ? 0 : c * scan_chunk, nchunks == 1 ? n : std::min(n, (c + 1) * scan_chunk), _chunks[c]);
+    };
+    if (nchunks == 1)
+      scanChunk(0);
+    else // a lambda holding just a reference fits in std::function without an allocation
+      _pool->run(nchunks, [&scanChunk](int c) { scanChunk(c); });
+    return nchunks;
+  }
+
+  // runs scan like scanParts and replaces the contents of objs with the ids of all chunks, so
+  // objs only ever grows to the exact number of results.
+  template <typename Scan>
+  void scanChunks(Scan scan, std::vector<int> & objs)
+  {
+    int nchunks = scanParts(scan);
+    size_t total = 0;
+    for (int c = 0; c < nchunks; c++)
+      total += _chunks[c].size();
+    objs.clear();
+    objs.reserve(total);
+    for (int c = 0; c < nchunks; c++)
+      objs.insert(objs.end(), _chunks[c].begin(), _chunks[c].end());
+  }
+
+  // Compiled is a condition list prepared for VecStore.  Its scan is an instance of
+  // scanCompiled for the set of attributes the conditions test, so the per-object loop only
+  // contains the tests it needs, without dispatching on attribute ids.  scanCompiled tests the
+  // attributes in a fixed order, though, so only the longest start of the planned order that
+  // follows it is compiled; the conditions after that are tested one by one like query does.
+  // The plan is part of the compiled form and is redone by replan when it gets out of date.
+  struct Compiled : public Prepared
+  {
+    explicit Compiled(const std::vector<Attribute> & conds) : Prepared(conds) {}
+
+    typedef void (*Scan)(const VecStore &, const Compiled &, int, int, std::vector<int> &);
+    Scan scan = nullptr;
+    // the values the compiled conditions require of each attribute.
+    std::vector<int> values[nattribs];
+    // the remaining conditions.
+    std::vector<Attribute> rest;
+    // the number of live objects and the estimated matches of conds when the plan was made.
+    long planned_objects = 0;
+    std::vector<long> planned_matches;
+    // set when two conditions want different values of a single-valued attribute.
+    bool none = false;
+  };
+
+  // ScanCursor runs a compiled scan over one chunk of objects per batch, skipping chunks
+  // without matches.
+  struct ScanCursor : public Cursor
+  {
+    ScanCursor(const VecStore & store, const Compiled & c) : store(store), c(c) {}
+
+    virtual bool next(std::vector<int> & batch) override
+    {
+      batch.clear();
+      int n = c.none ? 0 : store._system.size();
+      while (batch.empty() && pos < n)
+      {
+        int end = std::min(n, pos + scan_chunk);
+        c.scan(store, c, pos, end, batch);
+        pos = end;
+      }
+      return !batch.empty();
+    }
+
+    const VecStore & store;
+    const Compiled & c;
+    int pos = 0;
+  };
+
+  // a multi-valued attribute's column and, for those with a wildcard, the flags of the objects
+  // having it.
+  struct ListColumn
+  {
+    AttributeId id;
+    Csr<int> VecStore::*lists;
+    std::vector<bool> VecStore::*all;
+  };
+
+  static const std::vector<ListColumn> & listColumns()
+  {
+    static const std::vector<ListColumn> columns = {
+        {AttributeId::Tag, &VecStore::_tags, nullptr},
+        {AttributeId::Boundary, &VecStore::_boundaries, &VecStore::_all_boundaries},
+        {AttributeId::Subdomain, &VecStore::_subdomains, &VecStore::_all_subdomains},
+        {AttributeId::ExecOn, &VecStore::_execute_ons, nullptr},
+    };
+    return columns;
+  }
+
+  // returns conds in the order that minimizes the expected cost of testing them, that is by
+  // increasing cost / (1 - selectivity): single-valued attributes cost one comparison and
+  // multi-valued ones about one per value an object has.
+  std::vector<Attribute> plan(const std::vector<Attribute> & conds) const
+  {
+    double n = std::max(1L, liveObjects());
+    std::vector<std::pair<double, Attribute>> ranked;
+    for (auto & cond : conds)
+    {
+      double cost = isMultiValued(cond.id) ? 1 + _counts.total(cond.id) / n : 1;
+      double rejected = 1 - std::min(1.0, matches(cond) / n);
+      ranked.push_back({rejected > 0 ? cost / rejected : std::numeric_limits<double>::infinity(), cond});
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<double, Attribute> & a, const std::pair<double, Attribute> & b) {
+      return a.first < b.first;
+    });
+
+    std::vector<Attribute> planned;
+    for (auto & r : ranked)
+      planned.push_back(r.second);
+    return planned;
+  }
+
+  // (re)plans c and picks the scanCompiled instance for the compiled conditions.
+  void compile(Compiled & c) const
+  {
+    for (auto & values : c.values)
+      values.clear();
+    c.rest.clear();
+    int mask = 0;
+    int last = 0;
+    for (auto & cond : plan(c.conds))
+    {
+      int a = static_cast<int>(cond.id);
+      if (a < last || !c.rest.empty())
+      {
+        c.rest.push_back(cond);
+        continue;
+      }
+      last = a;
+      mask |= bit(cond.id);
+      c.values[a].push_back(cond.value);
+    }
+    c.scan = scanTable()[mask];
+
+    c.planned_objects = liveObjects();
+    c.planned_matches.clear();
+    for (auto & cond : c.conds)
+      c.planned_matches.push_back(matches(cond));
+  }
+
+  // a plan is out of date once the number of objects or of the matches of a condition has
+  // changed by more than half (ignoring small counts).
+  bool drifted(const Compiled & c) const
+  {
+    auto far = [](long planned, long now) { return std::abs(now - planned) > std::max(64L, planned / 2); };
+    if (far(c.planned_objects, liveObjects()))
+      return true;
+    for (size_t i = 0; i < c.conds.size(); i++)
+      if (far(c.planned_matches[i], matches(c.conds[i])))
+        return true;
+    return false;
+  }
+
+  // appends the ids in [begin, end) of the objects that match c's conditions to objs; Mask has
+  // the bit(id) of every attribute with conditions set.
+  template <int Mask>
+  static void scanCompiled(const VecStore & s, const Compiled & c, int begin, int end, std::vector<int> & objs)
+  {
+    const int thread = (Mask & bit(AttributeId::Thread)) ? c.values[static_cast<int>(AttributeId::Thread)][0] : 0;
+    const int system = (Mask & bit(AttributeId::System)) ? c.values[static_cast<int>(AttributeId::System)][0] : 0;
+    // compared as an int like matches does, so that values other than 0 and 1 match nothing.
+    const int enabled = (Mask & bit(AttributeId::Enabled)) ? c.values[static_cast<int>(AttributeId::Enabled)][0] : 0;
+    auto & tags = c.values[static_cast<int>(AttributeId::Tag)];
+    auto & boundaries = c.values[static_cast<int>(AttributeId::Boundary)];
+    auto & subdomains = c.values[static_cast<int>(AttributeId::Subdomain)];
+    auto & execute_ons = c.values[static_cast<int>(AttributeId::ExecOn)];
+    for (int i = begin; i < end; i++)
+    {
+      if (s._removed[i])
+        continue;
+      if ((Mask & bit(AttributeId::Thread)) && s._thread[i] != thread)
+        continue;
+      if ((Mask & bit(AttributeId::System)) && s._system[i] != system)
+        continue;
+      if ((Mask & bit(AttributeId::Enabled)) && s._enabled[i] != enabled)
+        continue;
+      if ((Mask & bit(AttributeId::Tag)) && !containsAll(s._tags, i, tags))
+        continue;
+      if ((Mask & bit(AttributeId::Boundary)) && !s._all_boundaries[i] && !containsAll(s._boundaries, i, boundaries))
+        continue;
+      if ((Mask & bit(AttributeId::Subdomain)) && !s._all_subdomains[i] && !containsAll(s._subdomains, i, subdomains))
+        continue;
+      if ((Mask & bit(AttributeId::ExecOn)) && !containsAll(s._execute_ons, i, execute_ons))
+        continue;
+      if (!c.rest.empty() && !s.matchesAll(i, c.rest))
+        continue;
+      objs.push_back(i);
+    }
+  }
+
+  static constexpr int bit(AttributeId id) { return 1 << (static_cast<int>(id) - 1); }
+
+  static bool containsAll(const Csr<int> & lists, int i, const std::vector<int> & values)
+  {
+    auto row = lists[i];
+    for (auto v : values)
+    {
+      auto it = row.begin();
+      while (it != row.end() && *it != v)
+        ++it;
+      if (it == row.end())
+        return false;
+    }
+    return true;
+  }
+
+  // the scanCompiled instances for every attribute mask.
+  static const Compiled::Scan * scanTable()
+  {
+    static Compiled::Scan table[1 << (nattribs - 1)];
+    static bool filled = (FillScanTable<(1 << (nattribs - 1)) - 1>::fill(table), true);
+    (void)filled;
+    return table;
+  }
+
+  template <int Mask, int Unused = 0>
+  struct FillScanTable
+  {
+    static void fill(Compiled::Scan * table)
+    {
+      table[Mask] = &scanCompiled<Mask>;
+      FillScanTable<Mask - 1>::fill(table);
+    }
+  };
+
+  template <int Unused>
+  struct FillScanTable<-1, Unused>
+  {
+    static void fill(Compiled::Scan *) {}
+  };
+
+  // SharedConds numbers the distinct conditions of a set of queries for queryAll and finds the
+  // conditions on an attribute that a value satisfies.
+  struct SharedConds
+  {
+    explicit SharedConds(const std::vector<std::vector<Attribute>> & queries)
+    {
+      std::map<std::pair<int, int>, int> index;
+      for (auto & conds : queries)
+      {
+        uses.push_back({});
+        for (auto & cond : conds)
+        {
+          int a = static_cast<int>(cond.id);
+          if (cond.id == AttributeId::None || a >= nattribs)
+            throw std::runtime_error("unknown AttributeId " + std::to_string(a));
+          auto it = index.emplace(std::make_pair(a, cond.value), index.size()).first;
+          uses.back().push_back(it->second);
+        }
+      }
+      ncond = index.size();
+
+      for (auto & entry : index)
+      {
+        auto & on = attribs[entry.first.first];
+        on.conds.push_back(entry.second);
+        on.values.push_back(entry.first.second);
+      }
+      // the values of most attributes are small integers, so a table indexed by value usually
+      // finds a value's condition; large or wide spread values fall back to a hash map.
+      for (auto & on : attribs)
+      {
+        if (on.conds.empty())
+          continue;
+        long lo = on.values.front(), hi = on.values.back();
+        if (hi - lo < max_table)
+        {
+          on.min = lo;
+          on.table.assign(hi - lo + 1, -1);
+          for (size_t i = 0; i < on.values.size(); i++)
+            on.table[on.values[i] - lo] = on.conds[i];
+        }
+        else
+          for (size_t i = 0; i < on.values.size(); i++)
+            on.map[on.values[i]] = on.conds[i];
+      }
+    }
+
+    struct Attrib
+    {
+      // the conditions on the attribute ordered by value, and their values.
+      std::vector<int> conds;
+      std::vector<int> values;
+      int min = 0;
+      std::vector<int> table;
+      std::unordered_map<int, int> map;
+
+      // returns the condition on the attribute that value satisfies, or -1 if there is none.
+      int find(int value) const
+      {
+        if (!table.empty())
+        {
+          size_t i = size_t(long(value) - min);
+          return i < table.size() ? table[i] : -1;
+        }
+        auto it = map.find(value);
+        return it == map.end() ? -1 : it->second;
+      }
+    };
+
+    static const long max_table = 1 << 16;
+
+    int ncond;
+    Attrib attribs[nattribs];
+    // the conditions of every query.
+    std::vector<std::vector<int>> uses;
+  };
+
+  // appends the ids of the objects in [begin, end) that match each of shared's queries to the
+  // query's vector in results.
+  void scanShared(const SharedConds & shared, int begin, int end, std::vector<std::vector<int>> & results) const
+  {
+    int nwords = (end - begin + 63) / 64;
+    std::vector<uint64_t> bits(size_t(shared.ncond + 1) * nwords);
+    // the last bitset holds the objects that aren't removed.
+    uint64_t * live = &bits[size_t(shared.ncond) * nwords];
+    auto mark = [&](int cond, int i) { bits[size_t(cond) * nwords + (i - begin) / 64] |= uint64_t(1) << ((i - begin) % 64); };
+
+    for (int i = begin; i < end; i++)
+      if (!_removed[i])
+        live[(i - begin) / 64] |= uint64_t(1) << ((i - begin) % 64);
+    for (int a = 0; a < nattribs; a++)
+    {
+      auto & on = shared.attribs[a];
+      if (on.conds.empty())
+        continue;
+      switch (static_cast<AttributeId>(a))
+      {
+        case AttributeId::Thread:
+          markValues(on, _thread, begin, end, mark);
+          break;
+        case AttributeId::System:
+          markValues(on, _system, begin, end, mark);
+          break;
+        case AttributeId::Enabled:
+          markValues(on, _enabled, begin, end, mark);
+          break;
+        case AttributeId::Tag:
+          markLists(on, _tags, nullptr, begin, end, mark);
+          break;
+        case AttributeId::Boundary:
+          markLists(on, _boundaries, &_all_boundaries, begin, end, mark);
+          break;
+        case AttributeId::Subdomain:
+          markLists(on, _subdomains, &_all_subdomains, begin, end, mark);
+          break;
+        default:
+          markLists(on, _execute_ons, nullptr, begin, end, mark);
+          break;
+      }
+    }
+
+    for (size_t q = 0; q < shared.uses.size(); q++)
+    {
+      auto & conds = shared.uses[q];
+      for (int w = 0; w < nwords; w++)
+      {
+        uint64_t m = live[w];
+        for (size_t j = 0; j < conds.size() && m != 0; j++)
+          m &= bits[size_t(conds[j]) * nwords + w];
+        for (; m != 0; m &= m - 1)
+          results[q].push_back(begin + w * 64 + __builtin_ctzll(m));
+      }
+    }
+  }
+
+  // mark the objects in [begin, end) that satisfy one of the conditions in on for a single-valued
+  // and for a multi-valued attribute; objects with all set (the wildcard) satisfy all of them.
+  template <typename Column, typename Mark>
+  static void markValues(const SharedConds::Attrib & on, const Column & column, int begin, int end, Mark mark)
+  {
+    for (int i = begin; i < end; i++)
+    {
+      int c = on.find(column[i]);
+      if (c >= 0)
+        mark(c, i);
+    }
+  }
+
+  template <typename T, typename Mark>
+  static void markLists(const SharedConds::Attrib & on, const Csr<T> & lists, const std::vector<bool> * all, int begin, int end, Mark mark)
+  {
+    for (int i = begin; i < end; i++)
+    {
+      if (all && (*all)[i])
+      {
+        for (auto c : on.conds)
+          mark(c, i);
+        continue;
+      }
+      for (auto v : lists[i])
+      {
+        int c = on.find(v);
+        if (c >= 0)
+          mark(c, i);
+      }
+    }
+  }
+
+  // appends the ids in [begin, end) of the objects that match all of conds to objs.
+  void scan(const std::vector<Attribute> & conds, int begin, int end, std::vector<int> & objs) const
+  {
+    for (int i = begin; i < end; i++)
+      if (!_removed[i] && matchesAll(i, conds))
+        objs.push_back(i);
+  }
+
+  bool matchesAll(int i, const std::vector<Attribute> & conds) const
+  {
+    for (auto & cond : conds)
+      if (!matches(i, cond))
+        return false;
+    return true;
+  }
+
+  // returns whether object i satisfies cond.
+  bool matches(int i, const Attribute & cond) const
+  {
+    switch (cond.id)
+    {
+      case AttributeId::Thread:
+        return cond.value == _thread[i];
+      case AttributeId::System:
+        return cond.value == _system[i];
+      case AttributeId::Enabled:
+        return cond.value == _enabled[i];
+      case AttributeId::Boundary:
+        return _all_boundaries[i] || contains(_boundaries[i], cond.value);
+      case AttributeId::Subdomain:
+        return _all_subdomains[i] || contains(_subdomains[i], cond.value);
+      case AttributeId::ExecOn:
+        return contains(_execute_ons[i], cond.value);
+      case AttributeId::Tag:
+        return contains(_tags[i], cond.value);
+      default:
+        throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(cond.id)));
+    }
+  }
+
+  static bool contains(Csr<int>::Row row, int value)
+  {
+    for (auto v : row)
+      if (v == value)
+        return true;
+    return false;
+  }
+
+  // adds one object; attribs is a vector or a Batch row.
+  template <typename Attribs>
+  void append(int obj_id, const Attribs & attribs)
+  {
+    if (obj_id < _system.size())
+      throw std::runtime_error("object with id " + std::to_string(obj_id) + " already added");
+
+    _system.push_back(-1);
+    _thread.push_back(-1);
+    _enabled.push_back(true);
+    _all_boundaries.push_back(false);
+    _all_subdomains.push_back(false);
+    _removed.resize(_system.size());
+
+    for (auto & attrib : attribs)
+    {
+      switch (attrib.id)
+      {
+        case AttributeId::Thread:
+          _thread.back() = attrib.value;
+          break;
+        case AttributeId::System:
+          _system.back() = attrib.value;
+          break;
+        case AttributeId::Enabled:
+          _enabled.back() = attrib.value;
+          break;
+        case AttributeId::Boundary:
+          if (attrib.value == wildcard)
+          {
+            if (!_all_boundaries.back())
+              _counts.add(attrib.id, wildcard);
+            _all_boundaries.back() = true;
+          }
+          else
+            _boundaries.push(attrib.value);
+          break;
+        case AttributeId::Subdomain:
+          if (attrib.value == wildcard)
+          {
+            if (!_all_subdomains.back())
+              _counts.add(attrib.id, wildcard);
+            _all_subdomains.back() = true;
+          }
+          else
+            _subdomains.push(attrib.value);
+          break;
+        case AttributeId::ExecOn:
+          _execute_ons.push(attrib.value);
+          break;
+        case AttributeId::Tag:
+          _tags.push(attrib.value);
+          break;
+        default:
+          throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(attrib.id)));
+      }
+    }
+    _counts.add(AttributeId::Thread, _thread.back());
+    _counts.add(AttributeId::System, _system.back());
+    _counts.add(AttributeId::Enabled, _enabled.back());
+    _tags.endRow();
+    _boundaries.endRow();
+    _subdomains.endRow();
+    _execute_ons.endRow();
+    countLists(obj_id, 1);
+  }
+
+  // adds sign to the counts of the multi-valued attribute values of object obj_id.  Like in query
+  // results, an object carrying a value more than once counts once.
+  void countLists(int obj_id, int sign)
+  {
+    for (auto & column : listColumns())
+    {
+      auto row = (this->*column.lists)[obj_id];
+      for (auto v = row.begin(); v != row.end(); ++v)
+        if (std::find(row.begin(), v, *v) == v)
+          _counts.add(column.id, *v, sign);
+    }
+  }
+
+  // the set helpers; they keep _counts up to date.
+  Change replace(AttributeId id, int & field, int value)
+  {
+    Change change = {field != value, field};
+    _counts.remove(id, field);
+    _counts.add(id, value);
+    field = value;
+    return change;
+  }
+
+  Change update(AttributeId id, Csr<int> & values, int obj_id, int value, SetOp op)
+  {
+    if (op == SetOp::Erase)
+    {
+      bool erased = values.erase(obj_id, value);
+      if (erased)
+        _counts.remove(id, value);
+      return {erased, 0};
+    }
+    if (values.contains(obj_id, value))
+      return {false, 0};
+    values.insert(obj_id, value);
+    _counts.add(id, value);
+    return {true, 0};
+  }
+
+  Change update(AttributeId id, Csr<int> & values, std::vector<bool> & all, int obj_id, int value, SetOp op)
+  {
+    if (value != wildcard)
+      return update(id, values, obj_id, value, op);
+    bool old = all[obj_id];
+    all[obj_id] = op == SetOp::Insert;
+    if (old != all[obj_id])
+      _counts.add(id, wildcard, all[obj_id] ? 1 : -1);
+    return {old != all[obj_id], 0};
+  }
+
+  std::vector<int> _system;
+  std::vector<int> _thread;
+  std::vector<bool> _enabled;
+  std::vector<bool> _all_boundaries;
+  std::vector<bool> _all_subdomains;
+  // multi-valued attributes are kept flat in one array per attribute rather than in a vector per
+  // object, which saves an allocation per object and attribute and keeps scans sequential.
+  Csr<int> _tags;
+  Csr<int> _boundaries;
+  Csr<int> _subdomains;
+  Csr<int> _execute_ons;
+  Tombstones _removed;
+  // the values of the live objects.
+  ValueCounts _counts;
+  // the ids found by each chunk of the last scan (see scanChunks).
+  std::vector<std::vector<int>> _chunks;
+};
+
+// sortBySize puts the shortest of the given id lists first.
+inline void
+sortBySize(std::vector<const std::vector<int> *> & lists)
+{
+  std::sort(lists.begin(), lists.end(), [](const std::vector<int> * a, const std::vector<int> * b) {
+    return a->size() < b->size();
+  });
+}
+
+// intersect replaces the contents of objs with the ids present in all of the given sorted id
+// lists, shortest first.
+void
+intersect(std::vector<const std::vector<int> *> & lists, std::vector<int> & objs)
+{
+  sortBySize(lists);
+
+  // the shortest list bounds the result; every other list only filters it.
+  if (lists.size() == 1)
+  {
+    objs.assign(lists[0]->begin(), lists[0]->end());
+    return;
+  }
+  objs.resize(lists[0]->size());
+  objs.resize(intersectSorted(lists[0]->data(), lists[0]->size(), lists[1]->data(), lists[1]->size(), objs.data()));
+  for (int i = 2; i < lists.size() && !objs.empty(); i++)
+    objs.resize(intersectSorted(objs.data(), objs.size(), lists[i]->data(), lists[i]->size(), objs.data()));
+}
+
+const size_t intersect_block = 1024;
+
+// intersectBlock intersects the ids [b, b + intersect_block) of the first of the given sorted id
+// lists, which should be the shortest, with the range of the other lists they span.  It returns
+// the number of ids in the intersection and sets ids to them: to the block itself if there is
+// only one list, to buf (of intersect_block ids) otherwise.
+inline size_t
+intersectBlock(const std::vector<const std::vector<int> *> & lists, size_t b, int * buf, const int *& ids)
+{
+  auto & first = *lists[0];
+  ids = first.data() + b;
+  size_t nids = std::min(intersect_block, first.size() - b);
+  for (int i = 1; i < lists.size() && nids > 0; i++)
+  {
+    auto & list = *lists[i];
+    auto lo = std::lower_bound(list.begin(), list.end(), ids[0]);
+    auto hi = std::upper_bound(lo, list.end(), ids[nids - 1]);
+    nids = intersectSorted(ids, nids, list.data() + (lo - list.begin()), hi - lo, buf);
+    ids = buf;
+  }
+  return nids;
+}
+
+// forEachIntersection calls f(id) for the ids present in all of the given sorted id lists in
+// increasing order until f returns false.  Instead of building the whole intersection like
+// intersect, it intersects the shortest list one block at a time in a buffer on the stack.
+template <typename F>
+void
+forEachIntersection(std::vector<const std::vector<int> *> & lists, F f)
+{
+  sortBySize(lists);
+
+  int buf[intersect_block];
+  for (size_t b = 0; b < lists[0]->size(); b += intersect_block)
+  {
+    const int * ids;
+    size_t nids = intersectBlock(lists, b, buf, ids);
+    for (size_t i = 0; i < nids; i++)
+      if (!f(ids[i]))
+        return;
+  }
+}
+
+// countIntersection counts the ids present in all of the given sorted id lists for which
+// accept(id) is true, and stops once the count reaches limit.
+template <typename Accept>
+size_t
+countIntersection(std::vector<const std::vector<int> *> & lists, Accept accept, size_t limit)
+{
+  size_t n = 0;
+  if (limit > 0)
+    forEachIntersection(lists, [&](int id) { return !accept(id) || ++n < limit; });
+  return n;
+}
+
+// firstIntersection returns the first limit ids present in all of the given sorted id lists
+// for which accept(id) is true.
+template <typename Accept>
+std::vector<int>
+firstIntersection(std::vector<const std::vector<int> *> & lists, Accept accept, size_t limit)
+{
+  std::vector<int> objs;
+  if (limit > 0)
+    forEachIntersection(lists, [&](int id) {
+      if (accept(id))
+        objs.push_back(id);
+      return objs.size() < limit;
+    });
+  return objs;
+}
+
+// Postings is the sorted list of the ids of the objects holding one attribute value.  Objects
+// are added in increasing id order and simply appended to ids.  Changes made later by
+// Storage::set are collected in two bitmaps of added and removed ids instead (see Pending), so
+// that toggling a value costs about as much as it does in BitmapStore rather than shifting a list
+// of a million ids; they are merged into ids once they reach half its length, and before a
+// query reads the list.
+struct Postings
+{
+  std::vector<int> ids;
+
+  // appends id, which must not be smaller than any id in the list.
+  void append(int id)
+  {
+    if (ids.empty() || ids.back() != id)
+      ids.push_back(id);
+  }
+
+  bool contains(int id) const
+  {
+    if (_pending)
+    {
+      if (_pending->added.contains(id))
+        return true;
+      if (_pending->removed.contains(id))
+        return false;
+    }
+    return std::binary_search(ids.begin(), ids.end(), id);
+  }
+
+  // the number of ids in the list including the pending changes (see merge).
+  size_t size() const { return ids.size() + (_pending ? _pending->nadded - _pending->nremoved : 0); }
+
+  // inserts and erases return false if id already was in or out of the list respectively.
+  bool insert(int id)
+  {
+    auto & p = pending();
+    if (p.removed.remove(id))
+      p.nremoved--;
+    else if (p.added.contains(id) || std::binary_search(ids.begin(), ids.end(), id))
+      return false;
+    else
+    {
+      p.added.add(id);
+      p.nadded++;
+    }
+    mergeIfLarge();
+    return true;
+  }
+
+  bool erase(int id)
+  {
+    auto & p = pending();
+    if (p.added.remove(id))
+      p.nadded--;
+    else if (p.removed.contains(id) || !std::binary_search(ids.begin(), ids.end(), id))
+      return false;
+    else
+    {
+      p.removed.add(id);
+      p.nremoved++;
+    }
+    mergeIfLarge();
+    return true;
+  }
+
+  // insert and erase for callers that know id is out of or in the list respectively, like
+  // Storage::set replacing the value of a single-valued attribute.  They skip looking id up in
+  // ids, which is most of the cost of a change to a long list.
+  void insertNew(int id)
+  {
+    auto & p = pending();
+    if (p.removed.remove(id))
+      p.nremoved--;
+    else
+    {
+      p.added.add(id);
+      p.nadded++;
+    }
+    mergeIfLarge();
+  }
+
+  void eraseOld(int id)
+  {
+    auto & p = pending();
+    if (p.added.remove(id))
+      p.nadded--;
+    else
+    {
+      p.removed.add(id);
+      p.nremoved++;
+    }
+    mergeIfLarge();
+  }
+
+  // folds the pending changes into ids.
+  void merge()
+  {
+    if (!_pending)
+      return;
+    // added never holds an id of ids, and removed only ids of ids.
+    std::vector<int> added;
+    std::vector<int> removed;
+    _pending->added.toVector(added);
+    _pending->removed.toVector(removed);
+    _pending.reset();
+    if (added.empty() && removed.empty())
+      return;
+
+    std::vector<int> merged;
+    merged.reserve(ids.size() + added.size() - removed.size());
+    size_t a = 0;
+    size_t r = 0;
+    for (auto id : ids)
+    {
+      while (a < added.size() && added[a] < id)
+        merged.push_back(added[a++]);
+      if (r < removed.size() && removed[r] == id)
+        r++;
+      else
+        merged.push_back(id);
+    }
+    merged.insert(merged.end(), added.begin() + a, added.end());
+    ids.swap(merged);
+  }
+
+  // maps every id to its new id (see Tombstones::renumber), dropping those of removed objects.
+  void renumber(const std::vector<int> & new_ids)
+  {
+    merge();
+    size_t n = 0;
+    for (auto id : ids)
+      if (new_ids[id] >= 0)
+        ids[n++] = new_ids[id];
+    ids.resize(n);
+    ids.shrink_to_fit();
+  }
+
+private:
+  // Pending holds the changes not merged into ids yet.  Most lists never change after they are
+  // loaded, so it is only allocated by the first change.
+  struct Pending
+  {
+    Bitmap added;
+    Bitmap removed;
+    size_t nadded = 0;
+    size_t nremoved = 0;
+  };
+
+  Pending & pending()
+  {
+    if (!_pending)
+      _pending.reset(new Pending());
+    return *_pending;
+  }
+
+  // merging costs a pass over ids, so waiting for a number of changes in proportion to its
+  // length keeps the cost of the merges of a list that only ever changes to a few copies per
+  // change.
+  void mergeIfLarge()
+  {
+    size_t n = _pending->nadded + _pending->nremoved;
+    if (n > 64 && 2 * n > ids.size())
+      merge();
+  }
+
+  std::unique_ptr<Pending> _pending;
+};
+
+// compactLists renumbers the ids in lists after a compaction and drops the lists left empty.
+void
+compactLists(std::unordered_map<int, Postings> & lists, const std::vector<int> & new_ids)
+{
+  for (auto it = lists.begin(); it != lists.end();)
+  {
+    it->second.renumber(new_ids);
+    if (it->second.ids.empty())
+      it = lists.erase(it);
+    else
+      ++it;
+  }
+}
+
+// A parallel load splits a batch into one consecutive range of objects per thread (a shard),
+// and every shard collects its objects in per-value lists or bitmaps of its own.  mergeShards
+// then merges the shards' parts of each attribute value into the store's structure for the
+// value, with one task per value.  merge(final, part) adds one part; the parts come in shard
+// order, i.e. in increasing id order, so id lists stay sorted by appending.
+template <typename Final, typename Part, typename Merge>
+void
+mergeShards(ThreadPool & pool,
+            std::unordered_map<int, Final> * dst,
+            const std::vector<std::vector<std::unordered_map<int, Part>>> & shards,
+            Merge merge)
+{
+  struct Job
+  {
+    Final * dst;
+    std::vector<const Part *> parts;
+  };
+
+  std::vector<Job> jobs;
+  for (size_t a = 0; a < shards[0].size(); a++)
+  {
+    std::unordered_map<int, size_t> job_of;
+    for (auto & shard : shards)
+      for (auto & entry : shard[a])
+      {
+        auto it = job_of.find(entry.first);
+        if (it == job_of.end())
+        {
+          it = job_of.emplace(entry.first, jobs.size()).first;
+          jobs.push_back({&dst[a][entry.first], {}});
+        }
+        jobs[it->second].parts.push_back(&entry.second);
+      }
+  }
+
+  pool.run(jobs.size(), [&](int j) {
+    for (auto part : jobs[j].parts)
+      merge(*jobs[j].dst, *part);
+  });
+}
+
+// shardBegin returns the first row of shard s of nshards over n rows.
+inline size_t
+shardBegin(size_t n, int s, int nshards)
+{
+  return n * s / nshards;
+}
+
+// matchingIds returns the sorted ids of the objects in lists (the per-value postings of cond's
+// attribute) that match cond, or nullptr if there are none.  Objects holding the wildcard value
+// are merged in for attributes that support it; merged then provides the storage for the result.
+const std::vector<int> *
+matchingIds(std::unordered_map<int, Postings> & lists, const Storage::Attribute & cond, std::vector<int> & merged)
+{
+  auto it = lists.find(cond.value);
+  const std::vector<int> * ids = nullptr;
+  if (it != lists.end())
+  {
+    it->second.merge();
+    ids = &it->second.ids;
+  }
+  if (!Storage::supportsWildcard(cond.id) || cond.value == Storage::wildcard)
+    return ids;
+
+  auto wild = lists.find(Storage::wildcard);
+  if (wild == lists.end())
+    return ids;
+  wild->second.merge();
+  if (!ids)
+    return &wild->second.ids;
+  merged.clear();
+  std::set_union(ids->begin(), ids->end(), wild->second.ids.begin(), wild->second.ids.end(), std::back_inserter(merged));
+  return &merged;
+}
+
+// listMatches counts the ids matchingIds would return from the list sizes alone, without merging
+// anything; objects in both the value's and the wildcard list count twice.
+long
+listMatches(const std::unordered_map<int, Postings> & lists, const Storage::Attribute & cond)
+{
+  long n = 0;
+  auto it = lists.find(cond.value);
+  if (it != lists.end())
+    n += it->second.size();
+  if (Storage::supportsWildcard(cond.id) && cond.value != Storage::wildcard)
+  {
+    auto wild = lists.find(Storage::wildcard);
+    if (wild != lists.end())
+      n += wild->second.size();
+  }
+  return n;
+}
+
+// ListsCursor streams the intersection of sorted id lists for IndexStore and BitmapStore one
+// block of the shortest list at a time (see intersectBlock), leaving out removed objects and
+// those missing from any of bitmaps.
+struct ListsCursor : public Storage::Cursor
+{
+  explicit ListsCursor(const Tombstones & removed) : removed(removed) {}
+
+  virtual bool next(std::vector<int> & batch) override
+  {
+    batch.clear();
+    int buf[intersect_block];
+    while (batch.empty() && !lists.empty() && pos < lists[0]->size())
+    {
+      const int * ids;
+      size_t nids = intersectBlock(lists, pos, buf, ids);
+      pos += intersect_block;
+      for (size_t i = 0; i < nids; i++)
+        if (!removed[ids[i]] && std::all_of(bitmaps.begin(), bitmaps.end(), [&](const Bitmap * b) { return b->contains(ids[i]); }))
+          batch.push_back(ids[i]);
+    }
+    return !batch.empty();
+  }
+
+  // sorted by size; empty if a condition matches nothing.
+  std::vector<const std::vector<int> *> lists;
+  // the storage of the lists with wildcard objects merged in (see matchingIds).
+  std::vector<std::vector<int>> merged;
+  std::vector<const Bitmap *> bitmaps;
+  const Tombstones & removed;
+  size_t pos = 0;
+};
+
+// IndexStore keeps an inverted index with a sorted list of object ids for every (AttributeId,
+// value) pair.  A query intersects the lists of its conditions starting from the shortest one, so
+// its cost follows the size of the lists involved rather than the total number of objects.
+class IndexStore : public Storage
+{
+public:
+  virtual void add(int obj_id, const std::vector<Attribute> & attribs) override { append(obj_id, attribs); }
+
+  virtual void addBatch(int first_id, const Batch & batch) override
+  {
+    if (parallel(batch))
+    {
+      addShards(first_id, batch);
+      return;
+    }
+    for (auto id : {AttributeId::Thread, AttributeId::System, AttributeId::Enabled})
+      reserveFor(_values[static_cast<int>(id)], first_id + batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+      append(first_id + i, batch[i]);
+  }
+
+  virtual std::vector<int> query(const std::vector<Attribute> & conds) override
+  {
+    std::vector<int> objs;
+    find(conds, objs);
+    return objs;
+  }
+
+  virtual void run(const Prepared & prepared, std::vector<int> & objs) override { find(prepared.conds, objs); }
+
+  // streams the intersection block by block like count.
+  virtual std::unique_ptr<Cursor> open(const Prepared & prepared) override
+  {
+    auto & conds = prepared.conds;
+    if (conds.empty())
+      return Storage::open(prepared);
+    std::unique_ptr<ListsCursor> cursor(new ListsCursor(_removed));
+    cursor->merged.resize(conds.size());
+    for (int i = 0; i < conds.size(); i++)
+    {
+      auto ids = matchingIds(_lists[checkedIndex(conds[i].id)], conds[i], cursor->merged[i]);
+      if (!ids)
+      {
+        cursor->lists.clear();
+        break;
+      }
+      cursor->lists.push_back(ids);
+    }
+    sortBySize(cursor->lists);
+    return cursor;
+  }
+
+  virtual size_t count(const std::vector<Attribute> & conds) override { return countMatches(conds, SIZE_MAX); }
+  virtual bool any(const std::vector<Attribute> & conds) override { return countMatches(conds, 1) > 0; }
+
+  // intersects block by block like count until it has limit ids.
+  virtual std::vector<int> first(const std::vector<Attribute> & conds, size_t limit) override
+  {
+    std::vector<int> objs;
+    if (conds.empty())
+    {
+      for (int i = 0; i < _nobjects && objs.size() < limit; i++)
+        if (!_removed[i])
+          objs.push_back(i);
+      return objs;
+    }
+    if (!findLists(conds))
+      return objs;
+    return firstIntersection(_query_lists, [this](int id) { return !_removed[id]; }, limit);
+  }
+
+  virtual Change set(int obj_id, const Attribute & attrib, SetOp op) override
+  {
+    if (obj_id >= _nobjects || _removed[obj_id])
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+    checkSetOp(attrib, op);
+
+    auto & lists = _lists[static_cast<int>(attrib.id)];
+    if (op == SetOp::Insert)
+      return {lists[attrib.value].insert(obj_id), 0};
+    if (op == SetOp::Erase)
+    {
+      auto it = lists.find(attrib.value);
+      return {it != lists.end() && it->second.erase(obj_id), 0};
+    }
+
+    int & value = _values[static_cast<int>(attrib.id)][obj_id];
+    int old = value;
+    if (old == attrib.value)
+      return {false, old};
+    // value says which list holds obj_id, so neither list needs to be searched for it.
+    if (old != -1)
+      lists[old].eraseOld(obj_id);
+    lists[attrib.value].insertNew(obj_id);
+    value = attrib.value;
+    return {true, old};
+  }
+
+  // removal only leaves a tombstone; the id stays in its lists, and queries filter it out of
+  // their results, until compact.
+  virtual void remove(int obj_id) override
+  {
+    if (obj_id >= _nobjects || !_removed.remove(obj_id))
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+  }
+
+  virtual void compact() override
+  {
+    auto new_ids = _removed.renumber();
+    for (auto & lists : _lists)
+      compactLists(lists, new_ids);
+    for (auto & values : _values)
+      dropRemoved(values, new_ids);
+    _nobjects = _removed.size();
+  }
+
+  virtual long liveObjects() const override { return _nobjects - _removed.count(); }
+
+  // the lists still hold the ids of removed objects until compact, so their sizes are scaled
+  // down by the share of live objects.
+  virtual long matches(const Attribute & cond) const override
+  {
+    long n = listMatches(_lists[checkedIndex(cond.id)], cond);
+    return _nobjects == 0 ? 0 : n * liveObjects() / _nobjects;
+  }
+
+private:
+  // replaces the contents of objs with the objects matching conds.  The lists and the
+  // intersection are built in the scratch members, so objs is only written once, at its final
+  // size.
+  void find(const std::vector<Attribute> & conds, std::vector<int> & objs)
+  {
+    _found.clear();
+    if (conds.empty())
+    {
+      for (int i = 0; i < _nobjects; i++)
+        if (!_removed[i])
+          _found.push_back(i);
+    }
+    else if (findLists(conds))
+    {
+      intersect(_query_lists, _found);
+      _removed.filter(_found);
+    }
+    objs.assign(_found.begin(), _found.end());
+  }
+
+  // sets _query_lists to the lists of the objects matching each of conds; returns false if a
+  // condition matches nothing.
+  bool findLists(const std::vector<Attribute> & conds)
+  {
+    _query_lists.clear();
+    if (_merged.size() < conds.size())
+      _merged.resize(conds.size());
+    for (int i = 0; i < conds.size(); i++)
+    {
+      auto ids = matchingIds(_lists[checkedIndex(conds[i].id)], conds[i], _merged[i]);
+      if (!ids)
+        return false;
+      _query_lists.push_back(ids);
+    }
+    return true;
+  }
+
+  // counts the objects matching conds, up to limit, from the same lists as query.
+  size_t countMatches(const std::vector<Attribute> & conds, size_t limit)
+  {
+    if (conds.empty())
+      return std::min(size_t(liveObjects()), limit);
+    if (!findLists(conds))
+      return 0;
+    if (_removed.count() == 0)
+      return countIntersection(_query_lists, [](int) { return true; }, limit);
+    return countIntersection(_query_lists, [this](int id) { return !_removed[id]; }, limit);
+  }
+
+  // adds one object; attribs is a vector or a Batch row.
+  template <typename Attribs>
+  void append(int obj_id, const Attribs & attribs)
+  {
+    grow(obj_id, obj_id + 1);
+    for (auto & attrib : attribs)
+    {
+      // ids are added in increasing order so appending keeps every list sorted; an object can
+      // carry the same value more than once (e.g. duplicate tags) but is only indexed once.
+      list(attrib.id, attrib.value).append(obj_id);
+      if (!isMultiValued(attrib.id))
+        _values[static_cast<int>(attrib.id)][obj_id] = attrib.value;
+    }
+  }
+
+  // loads a batch in parallel (see mergeShards).
+  void addShards(int first_id, const Batch & batch)
+  {
+    grow(first_id, first_id + batch.size());
+    int nshards = _pool->size();
+    std::vector<std::vector<std::unordered_map<int, std::vector<int>>>> shards(
+        nshards, std::vector<std::unordered_map<int, std::vector<int>>>(nattribs));
+    _pool->run(nshards, [&](int s) {
+      auto & lists = shards[s];
+      for (size_t i = shardBegin(batch.size(), s, nshards); i < shardBegin(batch.size(), s + 1, nshards); i++)
+      {
+        int obj_id = first_id + i;
+        for (auto & attrib : batch[i])
+        {
+          auto & ids = lists[checkedIndex(attrib.id)][attrib.value];
+          if (ids.empty() || ids.back() != obj_id)
+            ids.push_back(obj_id);
+          if (!isMultiValued(attrib.id))
+            _values[static_cast<int>(attrib.id)][obj_id] = attrib.value;
+        }
+      }
+    });
+    mergeShards(*_pool, _lists, shards, [](Postings & list, const std::vector<int> & part) {
+      list.ids.insert(list.ids.end(), part.begin(), part.end());
+    });
+  }
+
+  // makes room for the objects with ids first_id to nobjects - 1, which must all be new: a
+  // batch only partly past the last added object would otherwise put its ids out of order in
+  // the lists.
+  void grow(int first_id, int nobjects)
+  {
+    if (first_id < _nobjects)
+      throw std::runtime_error("object with id " + std::to_string(first_id) + " already added");
+    if (nobjects <= _nobjects)
+      return;
+    _nobjects = nobjects;
+    _removed.resize(_nobjects);
+    for (auto id : {AttributeId::Thread, AttributeId::System, AttributeId::Enabled})
+      _values[static_cast<int>(id)].resize(_nobjects, -1);
+  }
+
+  Postings & list(AttributeId id, int value) { return _lists[checkedIndex(id)][value]; }
+
+  static int checkedIndex(AttributeId id)
+  {
+    int i = static_cast<int>(id);
+    if (id == AttributeId::None || i >= nattribs)
+      throw std::runtime_error("unknown AttributeId " + std::to_string(i));
+    return i;
+  }
+
+  static const int nattribs = static_cast<int>(AttributeId::ExecOn) + 1;
+
+  int _nobjects = 0;
+  Tombstones _removed;
+  std::unordered_map<int, Postings> _lists[nattribs];
+  // the value of every object's single-valued attributes (-1 if it has none), which set needs
+  // to find the list a replaced value is in.
+  std::vector<int> _values[nattribs];
+  // scratch space for queries that keeps its memory from one to the next: the lists of the
+  // conditions, their storage where wildcard objects are merged in, and the intersection.
+  std::vector<const std::vector<int> *> _query_lists;
+  std::vector<std::vector<int>> _merged;
+  std::vector<int> _found;
+};
+
+// BitmapStore is an inverted index like IndexStore that keeps the object sets of the low
+// cardinality attributes (thread, system, enabled, tag and execute_on) in compressed bitmaps.
+// Each of their values matches a large fraction of all objects, where a bitmap is several times
+// smaller than an id list and intersects much faster.  Boundary and subdomain values match few
+// objects each and keep sorted id lists; those drive a query when present and the bitmaps only
+// probe the resulting candidates.
+class BitmapStore : public Storage
+{
+public:
+  virtual void add(int obj_id, const std::vector<Attribute> & attribs) override { append(obj_id, attribs); }
+
+  virtual void addBatch(int first_id, const Batch & batch) override
+  {
+    if (parallel(batch))
+    {
+      addShards(first_id, batch);
+      return;
+    }
+    for (auto id : {AttributeId::Thread, AttributeId::System, AttributeId::Enabled})
+      reserveFor(_values[static_cast<int>(id)], first_id + batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+      append(first_id + i, batch[i]);
+  }
+
+  virtual std::vector<int> query(const std::vector<Attribute> & conds) override
+  {
+    std::vector<int> objs;
+    find(conds, objs);
+    return objs;
+  }
+
+  virtual void run(const Prepared & prepared, std::vector<int> & objs) override { find(prepared.conds, objs); }
+
+  // streams queries with list conditions like IndexStore, probing the bitmaps for every id of
+  // the intersection of the lists; the others run up front.
+  virtual std::unique_ptr<Cursor> open(const Prepared & prepared) override
+  {
+    if (!_optimized || !_touched.empty())
+      optimize();
+    std::unique_ptr<ListsCursor> cursor(new ListsCursor(_removed));
+    auto & conds = prepared.conds;
+    cursor->merged.resize(conds.size());
+    if (!findSets(conds, cursor->merged, cursor->lists, cursor->bitmaps))
+    {
+      cursor->lists.clear();
+      return cursor;
+    }
+    if (cursor->lists.empty())
+      return Storage::open(prepared);
+    sortBySize(cursor->lists);
+    sortByCardinality(cursor->bitmaps);
+    return cursor;
+  }
+
+  virtual size_t count(const std::vector<Attribute> & conds) override { return countMatches(conds, SIZE_MAX); }
+  virtual bool any(const std::vector<Attribute> & conds) override { return countMatches(conds, 1) > 0; }
+
+  // stops the intersection of the lists, or of the bitmaps, once it has limit ids.
+  virtual std::vector<int> first(const std::vector<Attribute> & conds, size_t limit) override
+  {
+    if (!_optimized || !_touched.empty())
+      optimize();
+    std::vector<int> objs;
+    if (conds.empty())
+    {
+      for (int i = 0; i < _nobjects && objs.size() < limit; i++)
+        if (!_removed[i])
+          objs.push_back(i);
+      return objs;
+    }
+    if (_merged.size() < conds.size())
+      _merged.resize(conds.size());
+    if (!findSets(conds, _merged, _query_lists, _query_bitmaps))
+      return objs;
+
+    auto & bitmaps = _query_bitmaps;
+    sortByCardinality(bitmaps);
+    if (!_query_lists.empty())
+      return firstIntersection(_query_lists, [&](int id) {
+        return !_removed[id] && std::all_of(bitmaps.begin(), bitmaps.end(), [&](const Bitmap * b) { return b->contains(id); });
+      }, limit);
+    Bitmap::appendCommon(bitmaps, _removed.count() > 0 ? &_removed_ids : nullptr, objs, limit);
+    return objs;
+  }
+
+  virtual Change set(int obj_id, const Attribute & attrib, SetOp op) override
+  {
+    if (obj_id >= _nobjects || _removed[obj_id])
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+    checkSetOp(attrib, op);
+
+    if (isListAttribute(attrib.id))
+    {
+      auto & lists = _lists[static_cast<int>(attrib.id)];
+      if (op == SetOp::Insert)
+        return {lists[attrib.value].insert(obj_id), 0};
+      auto it = lists.find(attrib.value);
+      return {it != lists.end() && it->second.erase(obj_id), 0};
+    }
+
+    if (op == SetOp::Insert)
+      return {insertId(attrib, obj_id), 0};
+    if (op == SetOp::Erase)
+      return {eraseId(attrib, obj_id), 0};
+
+    int & value = _values[static_cast<int>(attrib.id)][obj_id];
+    int old = value;
+    if (old == attrib.value)
+      return {false, old};
+    eraseId({attrib.id, old, ""}, obj_id);
+    insertId(attrib, obj_id);
+    value = attrib.value;
+    return {true, old};
+  }
+
+  // like IndexStore, removal only leaves a tombstone that queries filter out until compact.
+  virtual void remove(int obj_id) override
+  {
+    if (obj_id >= _nobjects || !_removed.remove(obj_id))
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+    _removed_ids.add(obj_id);
+  }
+
+  virtual void compact() override
+  {
+    auto new_ids = _removed.renumber();
+    for (auto & m : _bitmaps)
+    {
+      for (auto it = m.begin(); it != m.end();)
+      {
+        Bitmap kept;
+        it->second.forEach([&](uint32_t id) {
+          if (new_ids[id] >= 0)
+            kept.add(new_ids[id]);
+        });
+        if (kept.empty())
+          it = m.erase(it);
+        else
+        {
+          kept.optimize();
+          it->second = std::move(kept);
+          ++it;
+        }
+      }
+    }
+    for (auto & lists : _lists)
+      compactLists(lists, new_ids);
+    for (auto & values : _values)
+      dropRemoved(values, new_ids);
+    _nobjects = _removed.size();
+    _removed_ids = Bitmap();
+    _optimized = true;
+    _touched.clear();
+  }
+
+  virtual long liveObjects() const override { return _nobjects - _removed.count(); }
+
+  // like IndexStore::matches, with bitmap cardinalities for the bitmap attributes.
+  virtual long matches(const Attribute & cond) const override
+  {
+    long n;
+    if (isListAttribute(cond.id))
+      n = listMatches(_lists[static_cast<int>(cond.id)], cond);
+    else
+    {
+      auto b = findBitmap(cond);
+      n = b ? b->cardinality() : 0;
+    }
+    return _nobjects == 0 ? 0 : n * liveObjects() / _nobjects;
+  }
+
+private:
+  // counts the objects matching conds, up to limit, without building any result.  With list
+  // conditions the lists drive like in query; otherwise the bitmaps are counted together.
+  size_t countMatches(const std::vector<Attribute> & conds, size_t limit)
+  {
+    if (!_optimized || !_touched.empty())
+      optimize();
+    if (conds.empty())
+      return std::min(size_t(liveObjects()), limit);
+    if (_merged.size() < conds.size())
+      _merged.resize(conds.size());
+    if (!findSets(conds, _merged, _query_lists, _query_bitmaps))
+      return 0;
+    auto & bitmaps = _query_bitmaps;
+
+    if (!_query_lists.empty())
+      return countIntersection(_query_lists, [&](int id) {
+        if (_removed[id])
+          return false;
+        for (auto b : bitmaps)
+          if (!b->contains(id))
+            return false;
+        return true;
+      }, limit);
+
+    // countCommon walks the blocks of the first bitmap.
+    sortByCardinality(bitmaps);
+    return Bitmap::countCommon(bitmaps, _removed.count() > 0 ? &_removed_ids : nullptr, limit);
+  }
+
+  // replaces the contents of objs with the objects matching conds, which are collected in _found
+  // first so that objs is only written once, at its final size.
+  void find(const std::vector<Attribute> & conds, std::vector<int> & objs)
+  {
+    if (!_optimized || !_touched.empty())
+      optimize();
+
+    _found.clear();
+    if (_merged.size() < conds.size())
+      _merged.resize(conds.size());
+    if (conds.empty())
+    {
+      for (int i = 0; i < _nobjects; i++)
+        if (!_removed[i])
+          _found.push_back(i);
+    }
+    else if (findSets(conds, _merged, _query_lists, _query_bitmaps))
+    {
+      // like intersect does with lists, start from the smallest bitmap and filter with the most
+      // selective ones first.
+      sortByCardinality(_query_bitmaps);
+      if (!_query_lists.empty())
+      {
+        intersect(_query_lists, _found);
+        for (auto b : _query_bitmaps)
+        {
+          int n = 0;
+          for (auto id : _found)
+            if (b->contains(id))
+              _found[n++] = id;
+          _found.resize(n);
+        }
+        _removed.filter(_found);
+      }
+      else
+        Bitmap::appendCommon(_query_bitmaps, _removed.count() > 0 ? &_removed_ids : nullptr, _found);
+    }
+    objs.assign(_found.begin(), _found.end());
+  }
+
+  // sets lists and bitmaps to the object sets matching conds, using merged (with room for all of
+  // conds) as the storage of merged lists; returns false if a condition matches nothing.
+  bool findSets(const std::vector<Attribute> & conds, std::vector<std::vector<int>> & merged,
+                std::vector<const std::vector<int> *> & lists, std::vector<const Bitmap *> & bitmaps)
+  {
+    lists.clear();
+    bitmaps.clear();
+    for (int i = 0; i < conds.size(); i++)
+    {
+      auto & cond = conds[i];
+      if (isListAttribute(cond.id))
+      {
+        auto ids = matchingIds(_lists[static_cast<int>(cond.id)], cond, merged[i]);
+        if (!ids)
+          return false;
+        lists.push_back(ids);
+      }
+      else
+      {
+        auto b = findBitmap(cond);
+        if (!b)
+          return false;
+        bitmaps.push_back(b);
+      }
+    }
+    return true;
+  }
+
+  static void sortByCardinality(std::vector<const Bitmap *> & bitmaps)
+  {
+    std::sort(bitmaps.begin(), bitmaps.end(), [](const Bitmap * a, const Bitmap * b) {
+      return a->cardinality() < b->cardinality();
+    });
+  }
+
+  // adds one object; attribs is a vector or a Batch row.
+  template <typename Attribs>
+  void append(int obj_id, const Attribs & attribs)
+  {
+    grow(obj_id, obj_id + 1);
+    for (auto & attrib : attribs)
+    {
+      if (isListAttribute(attrib.id))
+        _lists[static_cast<int>(attrib.id)][attrib.value].append(obj_id);
+      else
+        bitmap(attrib.id, attrib.value).add(obj_id);
+      if (!isMultiValued(attrib.id))
+        _values[static_cast<int>(attrib.id)][obj_id] = attrib.value;
+    }
+  }
+
+  // loads a batch in parallel (see mergeShards).  The shards' bitmaps cover disjoint id ranges
+  // and are merged by union.
+  void addShards(int first_id, const Batch & batch)
+  {
+    grow(first_id, first_id + batch.size());
+    int nshards = _pool->size();
+    std::vector<std::vector<std::unordered_map<int, Bitmap>>> bitmaps(
+        nshards, std::vector<std::unordered_map<int, Bitmap>>(nattribs));
+    std::vector<std::vector<std::unordered_map<int, std::vector<int>>>> lists(
+        nshards, std::vector<std::unordered_map<int, std::vector<int>>>(nattribs));
+    _pool->run(nshards, [&](int s) {
+      for (size_t i = shardBegin(batch.size(), s, nshards); i < shardBegin(batch.size(), s + 1, nshards); i++)
+      {
+        int obj_id = first_id + i;
+        for (auto & attrib : batch[i])
+        {
+          int a = checkedIndex(attrib.id);
+          if (isListAttribute(attrib.id))
+          {
+            auto & ids = lists[s][a][attrib.value];
+            if (ids.empty() || ids.back() != obj_id)
+              ids.push_back(obj_id);
+          }
+          else
+            bitmaps[s][a][attrib.value].add(obj_id);
+          if (!isMultiValued(attrib.id))
+            _values[a][obj_id] = attrib.value;
+        }
+      }
+    });
+    mergeShards(*_pool, _bitmaps, bitmaps, [](Bitmap & b, const Bitmap & part) { b |= part; });
+    mergeShards(*_pool, _lists, lists, [](Postings & list, const std::vector<int> & part) {
+      list.ids.insert(list.ids.end(), part.begin(), part.end());
+    });
+  }
+
+  // makes room for the objects with ids first_id to nobjects - 1, which must all be new: a
+  // batch only partly past the last added object would otherwise put its ids out of order in
+  // the lists.
+  void grow(int first_id, int nobjects)
+  {
+    if (first_id < _nobjects)
+      throw std::runtime_error("object with id " + std::to_string(first_id) + " already added");
+    if (nobjects <= _nobjects)
+      return;
+    _nobjects = nobjects;
+    _optimized = false;
+    _removed.resize(_nobjects);
+    for (auto id : {AttributeId::Thread, AttributeId::System, AttributeId::Enabled})
+      _values[static_cast<int>(id)].resize(_nobjects, -1);
+  }
+
+  // add obj_id to or remove it from the bitmap of attrib's value and remember the bitmap for the
+  // next optimize; they return false if that didn't change the bitmap.
+  bool insertId(const Attribute & attrib, int obj_id)
+  {
+    auto & b = bitmap(attrib.id, attrib.value);
+    if (b.contains(obj_id))
+      return false;
+    b.add(obj_id);
+    _touched.insert(&b);
+    return true;
+  }
+
+  bool eraseId(const Attribute & attrib, int obj_id)
+  {
+    auto & m = _bitmaps[static_cast<int>(attrib.id)];
+    auto it = m.find(attrib.value);
+    if (it == m.end() || !it->second.remove(obj_id))
+      return false;
+    _touched.insert(&it->second);
+    return true;
+  }
+
+  static bool isListAttribute(AttributeId id)
+  {
+    return id == AttributeId::Boundary || id == AttributeId::Subdomain;
+  }
+
+  Bitmap & bitmap(AttributeId id, int value) { return _bitmaps[checkedIndex(id)][value]; }
+
+  const Bitmap * findBitmap(const Attribute & attrib) const
+  {
+    auto & m = _bitmaps[checkedIndex(attrib.id)];
+    auto it = m.find(attrib.value);
+    return it == m.end() ? nullptr : &it->second;
+  }
+
+  static int checkedIndex(AttributeId id)
+  {
+    int i = static_cast<int>(id);
+    if (id == AttributeId::None || i >= nattribs)
+      throw std::runtime_error("unknown AttributeId " + std::to_string(i));
+    return i;
+  }
+
+  // bitmaps are compressed (e.g. runs for the "enabled" set) after loading, on the first query.
+  // After that only the bitmaps changed by set are optimized again.
+  void optimize()
+  {
+    if (!_optimized)
+    {
+      std::vector<Bitmap *> all;
+      for (auto & m : _bitmaps)
+        for (auto & entry : m)
+          all.push_back(&entry.second);
+      if (_pool)
+        _pool->run(all.size(), [&](int i) { all[i]->optimize(); });
+      else
+        for (auto b : all)
+          b->optimize();
+    }
+    else
+    {
+      for (auto b : _touched)
+        b->optimize();
+    }
+    _optimized = true;
+    _touched.clear();
+  }
+
+  static const int nattribs = static_cast<int>(AttributeId::ExecOn) + 1;
+
+  int _nobjects = 0;
+  Tombstones _removed;
+  // the same ids as _removed, for countCommon to leave out.
+  Bitmap _removed_ids;
+  bool _optimized = true;
+  std::unordered_map<int, Bitmap> _bitmaps[nattribs];
+  std::unordered_map<int, Postings> _lists[nattribs];
+  // the value of every object's single-valued attributes (-1 if it has none).
+  std::vector<int> _values[nattribs];
+  std::unordered_set<Bitmap *> _touched;
+  // scratch space for queries, as in IndexStore.
+  std::vector<const std::vector<int> *> _query_lists;
+  std::vector<const Bitmap *> _query_bitmaps;
+  std::vector<std::vector<int>> _merged;
+  std::vector<int> _found;
+};
+
+class SqlStore : public Storage
+{
+public:
+  // Schema picks how the tables are laid out.  Both store the interned integer values.  Rowid
+  // gives every multi-valued attribute a plain table of (id, value) rows and, once loaded, two
+  // covering indexes on it, by (value, id) for finding the objects with a value and by (id,
+  // value) for an object's values; the objects table gets a second index by id too.  Compact
+  // keeps the links in WITHOUT ROWID tables clustered by their (value, id) primary key, so the
+  // table doubles as the by-value index, and only adds the by-id index, which removing and
+  // compacting objects need.  That stores each link twice instead of three times.
+  enum class Schema
+  {
+    Rowid,
+    Compact,
+  };
+
+  // Strategy picks the SQL that finds the objects matching a query.  Join joins a link table
+  // for every multi-valued condition and needs DISTINCT since objects can match several rows of
+  // one table.  Exists checks those conditions with a correlated subquery for every object that
+  // passes the others, and Intersect intersects the ids matching each condition on its own.
+  // Auto starts every query shape on Join and tries one of the others on some of the next
+  // queries of the shape, then keeps to the one with the lowest median time relative to Join
+  // (see Choice).  A trial is cut off once it takes as long as Join did on the last query of the
+  // shape, since it has lost by then, so it at most doubles the time of the query it runs on;
+  // and a trial only runs if trials still take no more than half as long as the shape's queries
+  // with it, so the first is on the third query of a shape.
+  enum class Strategy
+  {
+    Join,
+    Exists,
+    Intersect,
+    Auto,
+  };
+
+  explicit SqlStore(Schema schema = Schema::Rowid)
+    : Storage(), _db(":memory:"), _in_transaction(false), _schema(schema)
+  {
+    _db.Execute("CREATE TABLE objects (id INTEGER PRIMARY KEY, system INTEGER, thread INTEGER, enabled INTEGER);");
+    for (auto & link : links)
+    {
+      if (_schema == Schema::Rowid)
+        _db.Execute("CREATE TABLE " + link.first + " (id INTEGER, " + link.second + " INTEGER);");
+      else
+        _db.Execute("CREATE TABLE " + link.first + " (" + link.second + " INTEGER, id INTEGER, PRIMARY KEY (" +
+                    link.second + ", id)) WITHOUT ROWID;");
+    }
+
+    // objects may list a value twice, which the compact tables' primary keys reject; the rows
+    // stand for sets either way.
+    _tblmain = _db.Prepare("INSERT INTO objects (id, system, thread, enabled) VALUES (?,?,?,?);");
+    _tbltag = _db.Prepare("INSERT OR IGNORE INTO tags (id, tag) VALUES (?,?);");
+    _tblbound = _db.Prepare("INSERT OR IGNORE INTO boundaries (id, boundary) VALUES (?,?);");
+    _tblsubdomain = _db.Prepare("INSERT OR IGNORE INTO subdomains (id, subdomain) VALUES (?,?);");
+    _tblexecons = _db.Prepare("INSERT OR IGNORE INTO execute_ons (id, execute_on) VALUES (?,?);");
+  }
+
+  ~SqlStore()
+  {
+    std::cout << "Sqlite db size" << (_schema == Schema::Compact ? " (compact schema)" : "") << ": " << bytes() / 1000
+              << " kB\n";
+  };
+
+  // returns the size of the database.
+  long bytes()
+  {
+    auto s1 = _db.Prepare("PRAGMA PAGE_SIZE;");
+    s1->Step();
+    long pagesize = s1->GetInt(0);
+
+    auto s2 = _db.Prepare("PRAGMA PAGE_COUNT;");
+    s2->Step();
+    long pagecount = s2->GetInt(0);
+    return pagesize * pagecount;
+  }
+
+  void setStrategy(Strategy strategy) { _strategy = strategy; }
+
+  virtual void add(int obj_id, const std::vector<Storage::Attribute> & attribs) override
+  {
+    beginLoad();
+    _nobjects = std::max(_nobjects, obj_id + 1);
+    _removed.resize(_nobjects);
+
+    bool enabled = true;
+    int thread = -1;
+    int system = -1;
+    for (auto & attrib : attribs)
+    {
+      switch (attrib.id)
+      {
+        case AttributeId::Thread:
+          thread = attrib.value;
+          break;
+        case AttributeId::System:
+          system = attrib.value;
+          break;
+        case AttributeId::Enabled:
+          enabled = attrib.value;
+          break;
+        case AttributeId::Boundary:
+          _tblbound->BindInt(1, obj_id);
+          _tblbound->BindInt(2, attrib.value);
+          _tblbound->Exec();
+          break;
+        case AttributeId::Subdomain:
+          _tblsubdomain->BindInt(1, obj_id);
+          _tblsubdomain->BindInt(2, attrib.value);
+          _tblsubdomain->Exec();
+          break;
+        case AttributeId::ExecOn:
+          _tblexecons->BindInt(1, obj_id);
+          _tblexecons->BindInt(2, attrib.value);
+          _tblexecons->Exec();
+          break;
+        case AttributeId::Tag:
+          _tbltag->BindInt(1, obj_id);
+          _tbltag->BindInt(2, attrib.value);
+          _tbltag->Exec();
+          break;
+        default:
+          throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(attrib.id)));
+      }
+    }
+
+    _tblmain->BindInt(1, obj_id);
+    _tblmain->BindInt(2, system);
+    _tblmain->BindInt(3, thread);
+    _tblmain->BindInt(4, enabled);
+    _tblmain->Exec();
+    countValues(attribs, system, thread, enabled);
+  }
+
+  // adds a batch with multi-row INSERT statements of up to rows_per_insert rows instead of one
+  // statement per row.
+  virtual void addBatch(int first_id, const Batch & batch) override
+  {
+    beginLoad();
+    _nobjects = std::max(_nobjects, int(first_id + batch.size()));
+    _removed.resize(_nobjects);
+
+    std::vector<int> objects;
+    std::vector<int> tags;
+    std::vector<int> boundaries;
+    std::vector<int> subdomains;
+    std::vector<int> execute_ons;
+    objects.reserve(4 * batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      int obj_id = first_id + i;
+      bool enabled = true;
+      int thread = -1;
+      int system = -1;
+      for (auto & attrib : batch[i])
+      {
+        switch (attrib.id)
+        {
+          case AttributeId::Thread:
+            thread = attrib.value;
+            break;
+          case AttributeId::System:
+            system = attrib.value;
+            break;
+          case AttributeId::Enabled:
+            enabled = attrib.value;
+            break;
+          case AttributeId::Boundary:
+            boundaries.insert(boundaries.end(), {obj_id, attrib.value});
+            break;
+          case AttributeId::Subdomain:
+            subdomains.insert(subdomains.end(), {obj_id, attrib.value});
+            break;
+          case AttributeId::ExecOn:
+            execute_ons.insert(execute_ons.end(), {obj_id, attrib.value});
+            break;
+          case AttributeId::Tag:
+            tags.insert(tags.end(), {obj_id, attrib.value});
+            break;
+          default:
+            throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(attrib.id)));
+        }
+      }
+      objects.insert(objects.end(), {obj_id, system, thread, enabled});
+      countValues(batch[i], system, thread, enabled);
+    }
+
+    insertRows("INTO objects (id, system, thread, enabled)", 4, objects);
+    insertRows("OR IGNORE INTO tags (id, tag)", 2, tags);
+    insertRows("OR IGNORE INTO boundaries (id, boundary)", 2, boundaries);
+    insertRows("OR IGNORE INTO subdomains (id, subdomain)", 2, subdomains);
+    insertRows("OR IGNORE INTO execute_ons (id, execute_on)", 2, execute_ons);
+  }
+
+  virtual std::vector<int> query(const std::vector<Storage::Attribute> & conds) override
+  {
+    std::vector<int> objs;
+    select("", conds, "", [&](SqlStatement & stmt) {
+      objs.clear();
+      while (stmt.Step())
+        objs.push_back(stmt.GetInt(0));
+    });
+    sortIds(objs);
+    return objs;
+  }
+
+  // works out the query's shape up front, so that runs only look up its statements.
+  virtual std::unique_ptr<Prepared> prepare(const std::vector<Attribute> & conds) override
+  {
+    auto sorted = shape(conds);
+    std::unique_ptr<SqlPrepared> p(new SqlPrepared(conds, sorted, shapeKey("", sorted, "")));
+    p->count_key = shapeKey(count_head, sorted, close_paren);
+    p->any_key = shapeKey(any_head, sorted, close_paren);
+    return p;
+  }
+
+  virtual void run(const Prepared & prepared, std::vector<int> & objs) override
+  {
+    auto & p = dynamic_cast<const SqlPrepared &>(prepared);
+    select(p.key, "", p.sorted, "", [this](SqlStatement & stmt) {
+      _found.clear();
+      while (stmt.Step())
+        _found.push_back(stmt.GetInt(0));
+    });
+    sortIds(_found);
+    objs.assign(_found.begin(), _found.end());
+  }
+
+  // steps a statement of its own, so that the cached ones stay free for other queries.  The
+  // cursor can't sort what it hasn't seen yet, so its statement orders the ids itself.
+  virtual std::unique_ptr<Cursor> open(const Prepared & prepared) override
+  {
+    return std::unique_ptr<Cursor>(new SqlCursor(prepareSelect("", prepared.conds, " ORDER BY 1")));
+  }
+
+  virtual size_t count(const std::vector<Storage::Attribute> & conds) override
+  {
+    size_t n = 0;
+    select(count_head, conds, close_paren, [&](SqlStatement & stmt) {
+      stmt.Step();
+      n = stmt.GetInt(0);
+    });
+    return n;
+  }
+
+  // sqlite stops evaluating an EXISTS subquery at its first row.
+  virtual bool any(const std::vector<Storage::Attribute> & conds) override
+  {
+    bool found = false;
+    select(any_head, conds, close_paren, [&](SqlStatement & stmt) {
+      stmt.Step();
+      found = stmt.GetInt(0);
+    });
+    return found;
+  }
+
+  // the same with the shape and keys worked out by prepare.
+  virtual size_t runCount(const Prepared & prepared) override
+  {
+    auto & p = dynamic_cast<const SqlPrepared &>(prepared);
+    size_t n = 0;
+    select(p.count_key, count_head, p.sorted, close_paren, [&](SqlStatement & stmt) {
+      stmt.Step();
+      n = stmt.GetInt(0);
+    });
+    return n;
+  }
+
+  virtual bool runAny(const Prepared & prepared) override
+  {
+    auto & p = dynamic_cast<const SqlPrepared &>(prepared);
+    bool found = false;
+    select(p.any_key, any_head, p.sorted, close_paren, [&](SqlStatement & stmt) {
+      stmt.Step();
+      found = stmt.GetInt(0);
+    });
+    return found;
+  }
+
+  // sqlite stops at the limit too when it can produce the ids in order, by walking the objects
+  // table, and otherwise sorts the matches first.
+  virtual std::vector<int> first(const std::vector<Storage::Attribute> & conds, size_t limit) override
+  {
+    std::vector<int> objs;
+    int param = conds.size() + 1;
+    select("", conds, " ORDER BY 1 LIMIT ?" + std::to_string(param), [&](SqlStatement & stmt) {
+      stmt.BindInt(param, std::min(limit, size_t(std::numeric_limits<int>::max())));
+      objs.clear();
+      while (stmt.Step())
+        objs.push_back(stmt.GetInt(0));
+    });
+    return objs;
+  }
+
+  virtual Change set(int obj_id, const Storage::Attribute & attrib, SetOp op) override
+  {
+    if (obj_id >= _nobjects || _removed[obj_id])
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+    checkSetOp(attrib, op);
+
+    std::string table;
+    std::string column;
+    switch (attrib.id)
+    {
+      case AttributeId::Thread:
+        table = "objects", column = "thread";
+        break;
+      case AttributeId::System:
+        table = "objects", column = "system";
+        break;
+      case AttributeId::Enabled:
+        table = "objects", column = "enabled";
+        break;
+      case AttributeId::Boundary:
+        table = "boundaries", column = "boundary";
+        break;
+      case AttributeId::Subdomain:
+        table = "subdomains", column = "subdomain";
+        break;
+      case AttributeId::ExecOn:
+        table = "execute_ons", column = "execute_on";
+        break;
+      default:
+        table = "tags", column = "tag";
+        break;
+    }
+
+    if (op == SetOp::Replace)
+    {
+      auto & select = statement("SELECT " + column + " FROM objects WHERE id=?;");
+      select->BindInt(1, obj_id);
+      select->Step();
+      int old = select->GetInt(0);
+      select->Reset();
+      if (old == attrib.value)
+        return {false, old};
+
+      auto & update = statement("UPDATE objects SET " + column + "=? WHERE id=?;");
+      update->BindInt(1, attrib.value);
+      update->BindInt(2, obj_id);
+      update->Exec();
+      _counts.remove(attrib.id, old);
+      _counts.add(attrib.id, attrib.value);
+      return {true, old};
+    }
+
+    auto & select = statement("SELECT 1 FROM " + table + " WHERE id=? AND " + column + "=? LIMIT 1;");
+    select->BindInt(1, obj_id);
+    select->BindInt(2, attrib.value);
+    bool present = select->Step();
+    select->Reset();
+    if (present == (op == SetOp::Insert))
+      return {false, 0};
+
+    auto & change = op == SetOp::Insert
+                        ? statement("INSERT INTO " + table + " (id, " + column + ") VALUES (?,?);")
+                        : statement("DELETE FROM " + table + " WHERE id=? AND " + column + "=?;");
+    change->BindInt(1, obj_id);
+    change->BindInt(2, attrib.value);
+    change->Exec();
+    _counts.add(attrib.id, attrib.value, op == SetOp::Insert ? 1 : -1);
+    return {true, 0};
+  }
+
+  // sqlite deletes the rows of a removed object right away; the tombstone only remembers the id
+  // for renumbering in compact.  While adds are running the tables have no index on id yet and
+  // finding the rows would scan them, so those removes wait for finishLoad to build the indexes.
+  virtual void remove(int obj_id) override
+  {
+    if (obj_id >= _nobjects || !_removed.remove(obj_id))
+      throw std::runtime_error("no object with id " + std::to_string(obj_id));
+    if (_in_transaction)
+      _pending_removes.push_back(obj_id);
+    else
+      deleteRows(obj_id);
+  }
+
+  virtual void compact() override
+  {
+    finishLoad();
+    auto new_ids = _removed.renumber();
+
+    _db.Execute("BEGIN TRANSACTION;");
+    _db.Execute("CREATE TEMP TABLE IF NOT EXISTS renumber (old INTEGER PRIMARY KEY, new INTEGER);");
+    auto & insert = statement("INSERT INTO renumber (old, new) VALUES (?,?);");
+    for (int i = 0; i < new_ids.size(); i++)
+    {
+      if (new_ids[i] < 0 || new_ids[i] == i)
+        continue;
+      insert->BindInt(1, i);
+      insert->BindInt(2, new_ids[i]);
+      insert->Exec();
+    }
+
+    for (auto & link : links)
+    {
+      auto & table = link.first;
+      if (_schema == Schema::Rowid)
+      {
+        _db.Execute("UPDATE " + table + " SET id=(SELECT new FROM renumber WHERE old=" + table +
+                    ".id) WHERE id IN (SELECT old FROM renumber);");
+        continue;
+      }
+      // changing the key of a WITHOUT ROWID row moves it, and the new key may still be taken by
+      // a link that is yet to be moved, so the compact tables get copied over in key order.
+      auto & column = link.second;
+      _db.Execute("CREATE TABLE renumbered (" + column + " INTEGER, id INTEGER, PRIMARY KEY (" + column +
+                  ", id)) WITHOUT ROWID;");
+      _db.Execute("INSERT INTO renumbered SELECT " + column + ", COALESCE((SELECT new FROM renumber WHERE old=" + table +
+                  ".id), id) FROM " + table + " ORDER BY " + column + ", id;");
+      _db.Execute("DROP TABLE " + table + ";");
+      _db.Execute("ALTER TABLE renumbered RENAME TO " + table + ";");
+      _db.Execute("CREATE INDEX idx2_" + column + " ON " + table + " (id);");
+    }
+    // object ids are unique, so they go through negative ids to not collide with ids that are
+    // yet to be moved.
+    _db.Execute("UPDATE objects SET id=-1-(SELECT new FROM renumber WHERE old=objects.id) WHERE id IN (SELECT old FROM renumber);");
+    _db.Execute("UPDATE objects SET id=-1-id WHERE id<0;");
+    _db.Execute("DELETE FROM renumber;");
+    _db.Execute("END TRANSACTION;");
+    _db.Execute("VACUUM;");
+    _nobjects = _removed.size();
+  }
+
+  virtual long liveObjects() const override { return _nobjects - _removed.count(); }
+
+  // counting matches in the tables would take a query per condition, so the store keeps its own
+  // value counts.
+  virtual long matches(const Attribute & cond) const override
+  {
+    long n = _counts.count(cond.id, cond.value);
+    if (supportsWildcard(cond.id) && cond.value != wildcard)
+      n += _counts.count(cond.id, wildcard);
+    return n;
+  }
+
+private:
+  // returns conds sorted by attribute, which is the order the SQL of a query lists them in.
+  // Condition lists that only differ in their values or order have the same shape and share a
+  // statement.
+  static std::vector<Storage::Attribute> shape(const std::vector<Storage::Attribute> & conds)
+  {
+    auto sorted = conds;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Storage::Attribute & a, const Storage::Attribute & b) {
+      return a.id < b.id;
+    });
+    return sorted;
+  }
+
+  // returns the table that holds the values of attribute id.
+  static std::string condTable(AttributeId id)
+  {
+    switch (id)
+    {
+      case AttributeId::Thread:
+      case AttributeId::System:
+      case AttributeId::Enabled:
+        return "objects";
+      case AttributeId::Boundary:
+        return "boundaries";
+      case AttributeId::Subdomain:
+        return "subdomains";
+      case AttributeId::ExecOn:
+        return "execute_ons";
+      case AttributeId::Tag:
+        return "tags";
+      default:
+        throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(id)));
+    }
+  }
+
+  // returns the SQL condition for cond on the rows of table, which is condTable(cond.id) or an
+  // alias of it, taking its value from parameter ?<i + 1>.
+  static std::string condSql(const Storage::Attribute & cond, int i, const std::string & table)
+  {
+    std::string param = "?" + std::to_string(i + 1);
+    switch (cond.id)
+    {
+      case AttributeId::Thread:
+        return table + ".thread=" + param;
+      case AttributeId::System:
+        return table + ".system=" + param;
+      case AttributeId::Enabled:
+        return table + ".enabled=" + param;
+      case AttributeId::Boundary:
+        return table + ".boundary IN (" + param + "," + std::to_string(wildcard) + ")";
+      case AttributeId::Subdomain:
+        return table + ".subdomain IN (" + param + "," + std::to_string(wildcard) + ")";
+      case AttributeId::ExecOn:
+        return table + ".execute_on=" + param;
+      case AttributeId::Tag:
+        return table + ".tag=" + param;
+      default:
+        throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(cond.id)));
+    }
+  }
+
+  // returns " WHERE <conds>" for conds given as " AND <cond>..." or nothing if there are none.
+  static std::string where(const std::string & conds)
+  {
+    return conds.empty() ? "" : " WHERE " + conds.substr(5, std::string::npos);
+  }
+
+  // returns a select of the distinct ids of the objects matching conds, which must be sorted by
+  // shape, where the value of conds[i] is parameter ?<i + 1>.
+  static std::string idsSql(Strategy strategy, const std::vector<Storage::Attribute> & conds)
+  {
+    std::string joins;
+    std::string tail;
+    std::vector<std::string> links;
+    for (int i = 0; i < conds.size(); i++)
+    {
+      auto table = condTable(conds[i].id);
+      if (table == "objects")
+        tail += " AND " + condSql(conds[i], i, table);
+      else if (strategy == Strategy::Join)
+      {
+        std::string alias = "l" + std::to_string(i);
+        joins += " JOIN " + table + " AS " + alias + " ON objects.id=" + alias + ".id AND " + condSql(conds[i], i, alias);
+      }
+      else if (strategy == Strategy::Exists)
+        tail += " AND EXISTS (SELECT 1 FROM " + table + " WHERE " + table + ".id=objects.id AND " + condSql(conds[i], i, table) + ")";
+      else
+        links.push_back(" FROM " + table + " WHERE " + condSql(conds[i], i, table));
+    }
+
+    if (strategy != Strategy::Intersect)
+      return (joins.empty() ? "SELECT objects.id" : "SELECT DISTINCT objects.id") + std::string(" FROM objects") + joins + where(tail);
+    // the link tables only hold rows of live objects, so the objects table is only needed for
+    // its own conditions.  INTERSECT drops repeated ids, but a lone link select has to do that
+    // itself.
+    std::string compound;
+    if (!tail.empty() || links.empty())
+      compound = "SELECT id FROM objects" + where(tail);
+    for (auto & link : links)
+    {
+      if (!compound.empty())
+        compound += " INTERSECT SELECT id" + link;
+      else
+        compound = (links.size() == 1 ? "SELECT DISTINCT id" : "SELECT id") + link;
+    }
+    return compound;
+  }
+
+  // returns the key select and the selector's timings go by for the ids of conds, sorted by
+  // shape, within head and suffix.
+  static std::string shapeKey(const std::string & head, const std::vector<Storage::Attribute> & sorted, const std::string & suffix)
+  {
+    std::string key = head + suffix;
+    for (auto & cond : sorted)
+      key += "," + std::to_string(static_cast<int>(cond.id));
+    return key;
+  }
+
+  // the strategies Auto picks from, how many queries of a shape it tries each one other than
+  // Join on before settling, and how long its trials may take relative to the shape's queries
+  // (see Strategy).
+  static const int nstrategies = 3;
+  static const int trials_per_shape = 3;
+  static constexpr double max_trial_share = 0.5;
+
+  // what count and any put around the select of the ids; kept as strings so that passing them
+  // to select doesn't build them every time.
+  static const std::string count_head;
+  static const std::string any_head;
+  static const std::string close_paren;
+
+  // Select is a query shape in the cache: its statement for each strategy, prepared on first
+  // use.
+  struct Select
+  {
+    std::string key;
+    SqlStatement::Ptr stmts[nstrategies];
+  };
+
+  // Choice is what Auto found out about the strategies for a query shape: the time each other
+  // strategy took on the queries it was tried on, relative to Join on the same query (infinite
+  // if it was cut off), and the strategy with the lowest median of those once all trials are in.
+  // Comparing on the same query keeps the values and result sizes, which differ between queries
+  // of a shape, out of the choice.  A strategy that lost most of its trials can't have the
+  // lowest median any more and isn't tried again.
+  struct Choice
+  {
+    // returns the strategy to try next, or -1 once all trials are in.
+    int next() const
+    {
+      int next = -1;
+      for (int i = 1; i < nstrategies; i++)
+      {
+        int lost = std::count_if(cost[i], cost[i] + trials[i], [](double c) { return c >= 1; });
+        if (trials[i] < trials_per_shape && lost <= trials_per_shape / 2 && (next < 0 || trials[i] < trials[next]))
+          next = i;
+      }
+      return next;
+    }
+
+    bool settled = false;
+    int trials[nstrategies] = {};
+    double cost[nstrategies][trials_per_shape];
+    // how long Join took on the last query of the shape, which limits the next trial, and how
+    // long the shape's queries and trials took in all.
+    double join_seconds = 0;
+    double run_seconds = 0;
+    double trial_seconds = 0;
+    Strategy best = Strategy::Join;
+  };
+
+  // returns whether conds, which Auto chooses a strategy for, have multi-valued conditions.
+  // Without them the strategies all come down to the same select of the objects table.
+  static bool linked(const std::vector<Storage::Attribute> & sorted)
+  {
+    for (auto & cond : sorted)
+      if (isMultiValued(cond.id))
+        return true;
+    return false;
+  }
+
+  // runs "<head><select of the ids matching conds><suffix>" with the condition values bound by
+  // calling use on the statement, which steps it and binds the suffix's own parameter, if any,
+  // as ?<conds.size() + 1>.  Statements are cached by query shape, so a query like a recent one
+  // only rebinds values instead of having sqlite parse and plan the SQL again.  While Auto tries
+  // out a strategy for the shape, use gets called for it and then for Join on the same values,
+  // and the trial may be cut off by an exception from the statement, so it has to start over
+  // every time.
+  template <typename Use>
+  void select(const std::string & head, const std::vector<Storage::Attribute> & conds, const std::string & suffix, Use use)
+  {
+    auto sorted = shape(conds);
+    select(shapeKey(head, sorted, suffix), head, sorted, suffix, use);
+  }
+
+  // the same with conds already sorted by shape and the key they give.
+  template <typename Use>
+  void select(const std::string & key, const std::string & head, const std::vector<Storage::Attribute> & sorted,
+              const std::string & suffix, Use use)
+  {
+    finishLoad();
+
+    auto it = _select_index.find(key);
+    if (it != _select_index.end())
+      _selects.splice(_selects.begin(), _selects, it->second);
+    else
+    {
+      _selects.emplace_front();
+      _selects.front().key = key;
+      _select_index[key] = _selects.begin();
+      if (_selects.size() > max_cached_selects)
+      {
+        _select_index.erase(_selects.back().key);
+        _selects.pop_back();
+      }
+    }
+    auto & s = _selects.front();
+
+    if (_strategy != Strategy::Auto || !linked(sorted))
+    {
+      runSelect(s, _strategy == Strategy::Auto ? Strategy::Join : _strategy, head, sorted, suffix, use);
+      return;
+    }
+    auto & choice = _choices[key];
+    if (choice.settled)
+    {
+      runSelect(s, choice.best, head, sorted, suffix, use);
+      return;
+    }
+    if (choice.join_seconds == 0 || choice.trial_seconds + choice.join_seconds > max_trial_share * choice.run_seconds)
+    {
+      choice.join_seconds = std::max(seconds(runSelect(s, Strategy::Join, head, sorted, suffix, use)), 1e-9);
+      choice.run_seconds += choice.join_seconds;
+      return;
+    }
+
+    // the trial goes first so that the caller is left with the results of Join even if it gets
+    // cut off.
+    int strategy = choice.next();
+    auto start = std::chrono::steady_clock::now();
+    double trial = trialSelect(s, static_cast<Strategy>(strategy), choice.join_seconds, head, sorted, suffix, use);
+    choice.trial_seconds += seconds(std::chrono::steady_clock::now() - start);
+    choice.join_seconds = std::max(seconds(runSelect(s, Strategy::Join, head, sorted, suffix, use)), 1e-9);
+    choice.run_seconds += choice.join_seconds;
+    choice.cost[strategy][choice.trials[strategy]++] = trial / choice.join_seconds;
+    if (choice.next() >= 0)
+      return;
+
+    choice.settled = true;
+    double best = 1;
+    for (int i = 1; i < nstrategies; i++)
+    {
+      if (choice.trials[i] < trials_per_shape)
+        continue;
+      auto & cost = choice.cost[i];
+      std::sort(cost, cost + trials_per_shape);
+      double median = cost[trials_per_shape / 2];
+      if (median < best)
+      {
+        best = median;
+        choice.best = static_cast<Strategy>(i);
+      }
+    }
+  }
+
+  // runs the statement of s for strategy like runSelect, but has sqlite stop it once it has run
+  // for limit seconds.  Returns how many seconds it took, or infinity if it was stopped.
+  template <typename Use>
+  double trialSelect(Select & s, Strategy strategy, double limit, const std::string & head,
+                     const std::vector<Storage::Attribute> & sorted, const std::string & suffix, Use & use)
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(limit);
+    bool stopped = false;
+    _db.SetInterrupt([&] { return stopped = std::chrono::steady_clock::now() > deadline; });
+    try
+    {
+      double t = seconds(runSelect(s, strategy, head, sorted, suffix, use));
+      _db.SetInterrupt(nullptr);
+      return t;
+    }
+    catch (...)
+    {
+      _db.SetInterrupt(nullptr);
+      if (!stopped)
+        throw;
+    }
+    return std::numeric_limits<double>::infinity();
+  }
+
+  static double seconds(std::chrono::steady_clock::duration d) { return std::chrono::duration<double>(d).count(); }
+
+  // runs the statement of s for strategy like select and returns how long that took.
+  template <typename Use>
+  std::chrono::steady_clock::duration runSelect(Select & s, Strategy strategy, const std::string & head,
+                                                const std::vector<Storage::Attribute> & sorted, const std::string & suffix,
+                                                Use & use)
+  {
+    auto & stmt = s.stmts[static_cast<int>(strategy)];
+    if (!stmt)
+      stmt = _db.Prepare(head + idsSql(strategy, sorted) + suffix + ";");
+    for (int i = 0; i < sorted.size(); i++)
+      stmt->BindInt(i + 1, sorted[i].value);
+
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+      use(*stmt);
+    }
+    catch (...)
+    {
+      // a statement left mid-step would carry on from there in the next query of the shape.
+      // Resetting after a failed step reports that failure again, which is already on its way.
+      try
+      {
+        stmt->Reset();
+      }
+      catch (const std::exception &)
+      {
+      }
+      throw;
+    }
+    stmt->Reset();
+    return std::chrono::steady_clock::now() - start;
+  }
+
+  // prepares a statement like select that is the caller's own, for cursors which keep it.  It
+  // uses the strategy Auto settled on for plain queries of the same shape, or Join until then.
+  SqlStatement::Ptr prepareSelect(const std::string & head, const std::vector<Storage::Attribute> & conds, const std::string & suffix)
+  {
+    finishLoad();
+
+    auto sorted = shape(conds);
+    auto strategy = _strategy == Strategy::Auto ? Strategy::Join : _strategy;
+    auto it = _choices.find(shapeKey("", sorted, ""));
+    if (_strategy == Strategy::Auto && it != _choices.end() && it->second.settled)
+      strategy = it->second.best;
+    auto stmt = _db.Prepare(head + idsSql(strategy, sorted) + suffix + ";");
+    for (int i = 0; i < sorted.size(); i++)
+      stmt->BindInt(i + 1, sorted[i].value);
+    return stmt;
+  }
+
+  // counts the values of a new object, each distinct one once (see VecStore::countLists);
+  // attribs is a vector or a Batch row.
+  template <typename Attribs>
+  void countValues(const Attribs & attribs, int system, int thread, bool enabled)
+  {
+    _counts.add(AttributeId::System, system);
+    _counts.add(AttributeId::Thread, thread);
+    _counts.add(AttributeId::Enabled, enabled);
+    for (auto a = attribs.begin(); a != attribs.end(); ++a)
+    {
+      if (!isMultiValued(a->id))
+        continue;
+      bool repeated = false;
+      for (auto b = attribs.begin(); b != a && !repeated; ++b)
+        repeated = b->id == a->id && b->value == a->value;
+      if (!repeated)
+        _counts.add(a->id, a->value);
+    }
+  }
+
+  // deletes the rows of the removed object obj_id.
+  void deleteRows(int obj_id)
+  {
+    uncountValues(obj_id);
+    for (auto table : {"objects", "tags", "boundaries", "subdomains", "execute_ons"})
+    {
+      auto & del = statement(std::string("DELETE FROM ") + table + " WHERE id=?;");
+      del->BindInt(1, obj_id);
+      del->Exec();
+    }
+  }
+
+  // takes the values of object obj_id, which is about to be deleted, out of the counts.
+  void uncountValues(int obj_id)
+  {
+    auto & select = statement("SELECT system, thread, enabled FROM objects WHERE id=?;");
+    select->BindInt(1, obj_id);
+    if (select->Step())
+    {
+      _counts.remove(AttributeId::System, select->GetInt(0));
+      _counts.remove(AttributeId::Thread, select->GetInt(1));
+      _counts.remove(AttributeId::Enabled, select->GetInt(2));
+    }
+    select->Reset();
+
+    struct Column
+    {
+      AttributeId id;
+      const char * sql;
+    };
+    static const Column columns[] = {
+        {AttributeId::Tag, "SELECT DISTINCT tag FROM tags WHERE id=?;"},
+        {AttributeId::Boundary, "SELECT DISTINCT boundary FROM boundaries WHERE id=?;"},
+        {AttributeId::Subdomain, "SELECT DISTINCT subdomain FROM subdomains WHERE id=?;"},
+        {AttributeId::ExecOn, "SELECT DISTINCT execute_on FROM execute_ons WHERE id=?;"},
+    };
+    for (auto & column : columns)
+    {
+      auto & values = statement(column.sql);
+      values->BindInt(1, obj_id);
+      while (values->Step())
+        _counts.remove(column.id, values->GetInt(0));
+      values->Reset();
+    }
+  }
+
+  // adds run in one transaction that lasts until the next query.
+  void beginLoad()
+  {
+    if (_in_transaction)
+      return;
+    _in_transaction = true;
+    _db.Execute("BEGIN TRANSACTION;");
+  }
+
+  // ends the transaction that adds run in, then builds the indexes the queries need and deletes
+  // the objects removed in the meantime.
+  void finishLoad()
+  {
+    if (!_in_transaction)
+      return;
+    _in_transaction = false;
+    _db.Execute("END TRANSACTION;");
+
+    _db.Execute("CREATE INDEX IF NOT EXISTS idx_objects ON objects (system, thread, enabled, id);");
+    if (_schema == Schema::Compact)
+    {
+      // the primary keys already order the links by value; rows of a WITHOUT ROWID table are
+      // found by their key, so an index on id alone also holds the value.
+      for (auto & link : links)
+        _db.Execute("CREATE INDEX IF NOT EXISTS idx2_" + link.second + " ON " + link.first + " (id);");
+    }
+    else
+    {
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx_subdomain ON subdomains (subdomain, id);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx_boundary ON boundaries (boundary, id);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx_tag ON tags (tag, id);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx_execute_on ON execute_ons (execute_on, id);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_objects ON objects (id, system, thread, enabled);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_subdomain ON subdomains (id, subdomain);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_boundary ON boundaries (id, boundary);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_tag ON tags (id, tag);");
+      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_execute_on ON execute_ons (id, execute_on);");
+    }
+
+    if (!_pending_removes.empty())
+    {
+      _db.Execute("BEGIN TRANSACTION;");
+      for (auto obj_id : _pending_removes)
+        deleteRows(obj_id);
+      _db.Execute("END TRANSACTION;");
+      _pending_removes.clear();
+    }
+    _db.Execute("ANALYZE");
+  }
+
+  // inserts the rows of ncols values each that are stored back to back in values into table
+  // (given with INTO, its column list and any conflict clause before).
+  void insertRows(const std::string & table, int ncols, const std::vector<int> & values)
+  {
+    size_t nrows = values.size() / ncols;
+    for (size_t row = 0; row < nrows; row += rows_per_insert)
+    {
+      size_t n = std::min(nrows - row, size_t(rows_per_insert));
+      std::string placeholders = "(?";
+      for (int c = 1; c < ncols; c++)
+        placeholders += ",?";
+      placeholders += ")";
+      std::string sql = "INSERT " + table + " VALUES " + placeholders;
+      for (size_t r = 1; r < n; r++)
+        sql += "," + placeholders;
+
+      auto & insert = statement(sql + ";");
+      const int * v = values.data() + row * ncols;
+      for (size_t k = 0; k < n * ncols; k++)
+        insert->BindInt(k + 1, v[k]);
+      insert->Exec();
+    }
+  }
+
+  // sqlite allows 999 bound parameters per statement by default.
+  static const size_t rows_per_insert = 128;
+  // select keeps the statements of this many query shapes.
+  static const size_t max_cached_selects = 512;
+
+  // sorts ids found by a query.  sqlite returns them in the order its plan visits them, which
+  // is by id for most queries but not all, while the other stores and the warehouse's cached
+  // results list objects by id.  Checking first keeps the common case cheap.
+  static void sortIds(std::vector<int> & ids)
+  {
+    if (!std::is_sorted(ids.begin(), ids.end()))
+      std::sort(ids.begin(), ids.end());
+  }
+
+  struct SqlPrepared : public Prepared
+  {
+    SqlPrepared(const std::vector<Attribute> & conds, std::vector<Attribute> sorted, std::string key)
+      : Prepared(conds), sorted(std::move(sorted)), key(std::move(key))
+    {
+    }
+
+    // conds sorted by shape and their keys in the select cache for run, runCount and runAny.
+    std::vector<Attribute> sorted;
+    std::string key;
+    std::string count_key;
+    std::string any_key;
+  };
+
+  struct SqlCursor : public Cursor
+  {
+    explicit SqlCursor(SqlStatement::Ptr stmt) : stmt(std::move(stmt)) {}
+
+    virtual bool next(std::vector<int> & batch) override
+    {
+      batch.clear();
+      // stepping a finished statement would start it over.
+      while (!done && batch.size() < cursor_batch)
+      {
+        done = !stmt->Step();
+        if (!done)
+          batch.push_back(stmt->GetInt(0));
+      }
+      return !batch.empty();
+    }
+
+    SqlStatement::Ptr stmt;
+    bool done = false;
+  };
+
+  // returns a prepared statement for sql, preparing it on first use.
+  SqlStatement::Ptr & statement(const std::string & sql)
+  {
+    auto & stmt = _statements[sql];
+    if (!stmt)
+      stmt = _db.Prepare(sql);
+    return stmt;
+  }
+
+  // the tables of the multi-valued attributes and their value columns.
+  static const std::vector<std::pair<std::string, std::string>> links;
+
+  SqliteDb _db;
+  bool _in_transaction;
+  Schema _schema;
+  SqlStatement::Ptr _tblmain;
+  SqlStatement::Ptr _tbltag;
+  SqlStatement::Ptr _tblbound;
+  SqlStatement::Ptr _tblsubdomain;
+  SqlStatement::Ptr _tblexecons;
+  std::map<std::string, SqlStatement::Ptr> _statements;
+  // the statements of the most recently used query shapes, the most recent first, and where to
+  // find them by shape (see select).
+  std::list<Select> _selects;
+  std::unordered_map<std::string, std::list<Select>::iterator> _select_index;
+  // what Auto found out about every shape it has seen, by the same keys.  It outlives the
+  // statements, which the cache may drop; a shape is a few attribute ids, so there are only so
+  // many.
+  std::unordered_map<std::string, Choice> _choices;
+  Strategy _strategy = Strategy::Auto;
+  int _nobjects = 0;
+  Tombstones _removed;
+  // objects removed while adds were running, whose rows finishLoad still has to delete.
+  std::vector<int> _pending_removes;
+  ValueCounts _counts;
+  // the results of the last run, before they are copied to the caller's buffer.
+  std::vector<int> _found;
+};
+
+const std::string SqlStore::count_head = "SELECT COUNT(*) FROM (";
+const std::string SqlStore::any_head = "SELECT EXISTS (";
+const std::string SqlStore::close_paren = ")";
+
+const std::vector<std::pair<std::string, std::string>> SqlStore::links = {
+    {"tags", "tag"}, {"boundaries", "boundary"}, {"subdomains", "subdomain"}, {"execute_ons", "execute_on"}};
+
+class Warehouse
+{
+public:
+  // Snapshot is the result of a shared query (see share) at the time it was taken.  It never
+  // changes, later writes to the warehouse produce new snapshots, and it stays valid for as long
+  // as it exists.  It lists copies of the objects as they were then, which writes leave alone.
+  // Every snapshot pins a reader slot (see Epochs::pin), so threads should only hold a few at a
+  // time.
+  class Snapshot
+  {
+  public:
+    const std::vector<const Object *> & objects() const { return *_objs; }
+    std::vector<const Object *>::const_iterator begin() const { return _objs->begin(); }
+    std::vector<const Object *>::const_iterator end() const { return _objs->end(); }
+    size_t size() const { return _objs->size(); }
+
+  private:
+    friend class Warehouse;
+    Snapshot(Epochs::Guard guard, const std::vector<const Object *> * objs)
+      : _guard(std::move(guard)), _objs(objs)
+    {
+    }
+
+    Epochs::Guard _guard;
+    const std::vector<const Object *> * _objs;
+  };
+
+  // Results is a view of the cached results of a query (see results).  The cache of a query read
+  // this way only keeps the ids of the matching objects, half the size of pointers, and the view
+  // looks every id up in the warehouse's table of objects as it iterates.  Each object is one
+  // load further away than through the pointers query returns, so iterating large results takes
+  // about 1.3x as long (see benchCache).  Like the cache, the view changes with the warehouse:
+  // writes invalidate its iterators, objects removed since its query was last read are left out,
+  // and reading its query with query empties it.
+  class Results
+  {
+  public:
+    class iterator
+    {
+    public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef Object value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef Object * pointer;
+      typedef Object & reference;
+
+      Object & operator*() const { return *_obj; }
+      Object * operator->() const { return _obj; }
+      iterator & operator++()
+      {
+        ++_id;
+        skipRemoved();
+        return *this;
+      }
+      iterator operator++(int)
+      {
+        iterator it = *this;
+        ++*this;
+        return it;
+      }
+      bool operator==(const iterator & other) const { return _id == other._id; }
+      bool operator!=(const iterator & other) const { return _id != other._id; }
+
+    private:
+      friend class Results;
+      iterator(const int * id, const int * end, Object * const * objects)
+        : _id(id), _end(end), _objects(objects), _obj(nullptr)
+      {
+        skipRemoved();
+      }
+
+      // moves on to the first id from here on whose object is still in the warehouse.
+      void skipRemoved()
+      {
+        while (_id != _end && !(_obj = _objects[*_id]))
+          ++_id;
+      }
+
+      const int * _id;
+      const int * _end;
+      Object * const * _objects;
+      Object * _obj;
+    };
+
+    iterator begin() const { return iterator(_ids->data(), _ids->data() + _ids->size(), _objects->data()); }
+    iterator end() const
+    {
+      auto end = _ids->data() + _ids->size();
+      return iterator(end, end, _objects->data());
+    }
+    // the number of objects the view iterates over, counted by looking every id up.
+    size_t size() const
+    {
+      size_t n = 0;
+      for (auto id : *_ids)
+        n += (*_objects)[id] != nullptr;
+      return n;
+    }
+    bool empty() const { return begin() == end(); }
+    // the ids of the objects in increasing order (see Object::_id), including those of removed
+    // objects until the query is read again.
+    const std::vector<int> & ids() const { return *_ids; }
+
+  private:
+    friend class Warehouse;
+    Results(const std::vector<int> * ids, const std::vector<Object *> * objects) : _ids(ids), _objects(objects) {}
+
+    const std::vector<int> * _ids;
+    const std::vector<Object *> * _objects;
+  };
+
+  Warehouse(Storage & s)
+    : _store(s), _version(new Version()){};
+
+  ~Warehouse()
+  {
+    for (auto obj : _objects)
+      delete obj;
+    for (auto obj : _frozen)
+      delete obj;
+    auto version = _version.load();
+    for (auto objs : version->results)
+      delete objs;
+    delete version;
+  }
+
+  // adds obj to the warehouse.  Rather than invalidating cached query results, obj is checked
+  // against the conditions of the prepared queries it could match (see _anchors) and appended to
+  // the up to date cached results of those it does match.
+  void addObject(std::unique_ptr<Object> obj)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Storage::Attribute> attribs;
+    appendAttributes(*obj, attribs);
+    obj->_id = _objects.size();
+    if (!_shared_queries.empty())
+      _frozen.push_back(new Object(*obj));
+    _objects.push_back(obj.get());
+    obj.release();
+    _store.add(_objects.size() - 1, attribs);
+    cacheAdded(_objects.size() - 1, attribs);
+    publish();
+  }
+
+  // adds all of objs like addObject would, but hands them to the store in large batches (see
+  // Storage::addBatch).
+  void addObjects(std::vector<std::unique_ptr<Object>> objs)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    reserveFor(_objects, _objects.size() + objs.size());
+    Storage::Batch batch;
+    for (size_t first = 0; first < objs.size(); first += batch_size)
+    {
+      size_t last = std::min(objs.size(), first + batch_size);
+      int first_id = _objects.size();
+      batch.clear();
+      auto pool = _store.threadPool();
+      if (pool && pool->size() > 1)
+        appendBatch(objs, first, last, batch, *pool);
+      else
+        for (size_t i = first; i < last; i++)
+        {
+          appendAttributes(*objs[i], batch.attribs);
+          batch.endObject();
+        }
+      for (size_t i = first; i < last; i++)
+      {
+        objs[i]->_id = _objects.size();
+        if (!_shared_queries.empty())
+          _frozen.push_back(new Object(*objs[i]));
+        _objects.push_back(objs[i].release());
+      }
+
+      _store.addBatch(first_id, batch);
+      for (size_t i = 0; i < batch.size(); i++)
+        cacheAdded(first_id + i, batch[i]);
+    }
+    publish();
+  }
+
+  // removes obj, an object in this warehouse, and hands it back to the caller.  The store only
+  // marks its id removed, and the cached results holding obj drop it the next time they are
+  // read; once removed ids make up a quarter of all ids the warehouse compacts the store (see
+  // compact).  Snapshots taken before the removal keep listing their copy of obj.
+  std::unique_ptr<Object> removeObject(Object * obj)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    checkObject(obj);
+    int id = obj->_id;
+    _store.remove(id);
+    std::vector<Storage::Attribute> attribs;
+    appendAttributes(*obj, attribs);
+    forEachMatchingQuery(attribs, [&](int q) {
+      if (_pointers[q])
+        _dead_objs[q].push_back(obj);
+      else
+        _dead_cached[q].push_back(id);
+      changed(q);
+    });
+
+    std::unique_ptr<Object> removed(_objects[id]);
+    _objects[id] = nullptr;
+    if (!_shared_queries.empty())
+    {
+      _unfrozen.push_back(_frozen[id]);
+      _frozen[id] = nullptr;
+    }
+    publish();
+    removed->_id = -1;
+    _nremoved++;
+    if (_nremoved >= min_compact && 4 * _nremoved >= _objects.size())
+      compactStore();
+    return removed;
+  }
+
+  // drops the removed objects from the warehouse and its store and renumbers the ids of the
+  // others.  Object pointers, including those in cached results, stay valid.
+  void compact()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    compactStore();
+  }
+
+  // changes one attribute of obj, an object in this warehouse, in both obj and the store (see
+  // Storage::set; the System and Tag values are given as strvalue).  Only the cached results of
+  // the queries with a condition on the old or the new value are invalidated; those of shared
+  // queries are updated and published instead (see share).
+  void set(Object * obj, Storage::Attribute attrib, Storage::SetOp op = Storage::SetOp::Replace)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    checkObject(obj);
+
+    std::string name = attrib.strvalue;
+    intern(attrib);
+    // any nonzero Enabled value enables obj, like Object::enabled, so the stores and the cache
+    // only ever see 0 or 1.
+    if (attrib.id == AttributeId::Enabled)
+      attrib.value = attrib.value != 0;
+    auto change = _store.set(obj->_id, attrib, op);
+    if (!change.changed)
+      return;
+
+    bool insert = op == Storage::SetOp::Insert;
+    switch (attrib.id)
+    {
+      case AttributeId::Thread:
+        obj->thread = attrib.value;
+        break;
+      case AttributeId::System:
+        obj->system = name;
+        break;
+      case AttributeId::Enabled:
+        obj->enabled = attrib.value;
+        break;
+      case AttributeId::Tag:
+        update(obj->tags, name, insert);
+        break;
+      case AttributeId::Boundary:
+        if (attrib.value == Storage::wildcard)
+          obj->all_boundaries = insert;
+        else
+          update(obj->boundaries, attrib.value, insert);
+        break;
+      case AttributeId::Subdomain:
+        if (attrib.value == Storage::wildcard)
+          obj->all_subdomains = insert;
+        else
+          update(obj->subdomains, attrib.value, insert);
+        break;
+      default:
+        update(obj->execute_ons, attrib.value, insert);
+        break;
+    }
+
+    invalidate(attrib.id, attrib.value);
+    if (op == Storage::SetOp::Replace)
+      invalidate(attrib.id, change.old);
+    if (!_shared_queries.empty())
+      setShared(obj);
+  }
+
+  // lets threads take snapshots of query_id (see snapshot).  From then on every write brings
+  // the query's cached results up to date and publishes them, which makes writes that change
+  // them slower.  Snapshots list copies of the objects rather than the objects themselves, so
+  // that set can change an object while readers look at it; once any query is shared the
+  // warehouse keeps a copy of every object.
+  void share(int query_id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    if (_shared[query_id])
+      return;
+    if (_shared_queries.empty())
+    {
+      _frozen.reserve(_objects.size());
+      for (auto obj : _objects)
+        _frozen.push_back(obj ? new Object(*obj) : nullptr);
+    }
+    _shared[query_id] = 1;
+    _shared_queries.push_back(query_id);
+    changed(query_id);
+    publish();
+  }
+
+  // prepares a query and returns an associated query_id (i.e. for use with the query function.
+  int prepare(std::vector<Storage::Attribute> conds)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto & cond : conds)
+      intern(cond);
+
+    // the results are only computed when first needed (see query and refreshAll).
+    int query_id = _obj_cache.size();
+    _query_version.push_back(1);
+    _cache_version.push_back(0);
+    _visited.push_back(0);
+    _dead_cached.push_back({});
+    _obj_cache.push_back({});
+    _dead_objs.push_back({});
+    _ptr_cache.push_back({});
+    _pointers.push_back(1);
+    _query_cache.push_back(conds);
+    _prepared.push_back(_store.prepare(conds));
+    _shared.push_back(0);
+    _republish.push_back(0);
+
+    if (conds.empty())
+      _unanchored.push_back(query_id);
+    else
+    {
+      auto & anchor = *std::min_element(conds.begin(), conds.end(), [](const Storage::Attribute & a, const Storage::Attribute & b) {
+        return anchorRank(a.id) < anchorRank(b.id);
+      });
+      _anchors[key(anchor.id, anchor.value)].push_back(query_id);
+      _anchored[static_cast<int>(anchor.id)].push_back(query_id);
+    }
+
+    for (auto & cond : conds)
+    {
+      addDependent(_dependents[key(cond.id, cond.value)], query_id);
+      addDependent(_conditioned[static_cast<int>(cond.id)], query_id);
+    }
+    return query_id;
+  }
+
+  // returns the current results of a query.  The returned vector belongs to the warehouse and
+  // changes with it, so threads sharing the warehouse use snapshot instead.  The cache of a query
+  // read this way keeps pointers to the objects rather than their ids (see results).
+  const std::vector<Object *> & query(int query_id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    usePointers(query_id);
+    refresh(query_id);
+    return _ptr_cache[query_id];
+  }
+
+  // returns the current results of a query like query does, but as a view of cached ids (see
+  // Results), for queries whose results are too many to keep pointers to.  A query's cache only
+  // ever holds one of the two, whichever it was last read as; switching converts it.
+  Results results(int query_id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    useIds(query_id);
+    refresh(query_id);
+    return Results(&_obj_cache[query_id], &_objects);
+  }
+
+  // returns the number of results of a query without computing them: the exact number if the
+  // cached results are up to date, and Storage::estimate otherwise.
+  double estimate(int query_id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    if (!stale(query_id))
+      return cachedSize(query_id);
+    return _store.estimate(_query_cache[query_id]);
+  }
+
+  // return the number of results of a query and whether it has any, from the cache if it is up to
+  // date and from Storage::runCount and Storage::runAny on the prepared query otherwise.  Neither
+  // computes or caches the results themselves, or allocates.
+  size_t count(int query_id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    if (!stale(query_id))
+      return cachedSize(query_id);
+    _store.replan(*_prepared[query_id]);
+    return _store.runCount(*_prepared[query_id]);
+  }
+
+  bool any(int query_id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    if (!stale(query_id))
+      return cachedSize(query_id) > 0;
+    _store.replan(*_prepared[query_id]);
+    return _store.runAny(*_prepared[query_id]);
+  }
+
+  // returns the memory taken by the cached results of all queries.
+  size_t cacheBytes()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t n = 0;
+    for (auto & ids : _obj_cache)
+      n += ids.capacity() * sizeof(int);
+    for (auto & objs : _ptr_cache)
+      n += objs.capacity() * sizeof(Object *);
+    return n;
+  }
+
+  // returns the first limit results of a query, those query lists first, from the cache if it is
+  // up to date and from Storage::first otherwise, which stops looking once it has found them.
+  // Like count it leaves the cache alone, so picking a few objects of a stale query costs in
+  // proportion to limit rather than to the number of objects.
+  std::vector<Object *> first(int query_id, size_t limit)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (query_id < 0 || query_id >= _obj_cache.size())
+      throw std::runtime_error("unknown query id");
+    std::vector<Object *> objs;
+    if (!stale(query_id))
+    {
+      // only one of the two caches holds the results.
+      dropDead(query_id);
+      auto & cached = _ptr_cache[query_id];
+      objs.assign(cached.begin(), cached.begin() + std::min(limit, cached.size()));
+      for (size_t i = 0; i < _obj_cache[query_id].size() && objs.size() < limit; i++)
+        objs.push_back(_objects[_obj_cache[query_id][i]]);
+      return objs;
+    }
+    for (auto id : _store.first(_query_cache[query_id], limit))
+      objs.push_back(_objects[id]);
+    return objs;
+  }
+
+  // brings the cached results of all queries up to date, computing those of the queries that
+  // are out of date together in one Storage::queryAll call.  This is much cheaper than leaving
+  // them to query one by one when many are, e.g. after preparing a lot of them.
+  void refreshAll()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<int> query_ids;
+    std::vector<std::vector<Storage::Attribute>> queries;
+    for (int q = 0; q < _obj_cache.size(); q++)
+    {
+      if (stale(q))
+      {
+        query_ids.push_back(q);
+        queries.push_back(_query_cache[q]);
+      }
+      else
+        dropDead(q);
+    }
+
+    auto results = _store.queryAll(queries);
+    for (size_t i = 0; i < query_ids.size(); i++)
+      setCache(query_ids[i], results[i]);
+  }
+
+  // returns the current results of a shared query (see share) as a snapshot; any number of
+  // threads may call it while others modify the warehouse.  Writes publish the results of the
+  // shared queries they change, so taking a snapshot is a load of the latest published version
+  // and never waits for the warehouse's lock.
+  Snapshot snapshot(int query_id)
+  {
+    auto guard = _epochs.pin();
+    auto & results = _version.load()->results;
+    if (query_id < 0 || query_id >= results.size() || !results[query_id])
+      throw std::runtime_error("query is not shared");
+    return Snapshot(std::move(guard), results[query_id]);
+  }
+
+private:
+  // Version holds the published results of the shared queries, indexed by query id and null for
+  // the others.  Versions never change; writes publish new ones that share the lists they leave
+  // alone.
+  struct Version
+  {
+    std::vector<const std::vector<const Object *> *> results;
+  };
+
+  // Replaced holds what a publish replaced, which pinned readers may still be looking at, until
+  // Epochs deletes it.
+  struct Replaced
+  {
+    ~Replaced()
+    {
+      delete version;
+      for (auto objs : results)
+        delete objs;
+      for (auto obj : objects)
+        delete obj;
+    }
+
+    const Version * version = nullptr;
+    std::vector<const std::vector<const Object *> *> results;
+    std::vector<const Object *> objects;
+  };
+
+  // brings the cached results of query_id up to date.
+  void refresh(int query_id)
+  {
+    if (stale(query_id))
+    {
+      // the store writes the results straight into the cache, in the memory of the old ones; a
+      // cache of pointers is made from them in the same way.
+      auto & ids = _pointers[query_id] ? _found : _obj_cache[query_id];
+      _store.replan(*_prepared[query_id]);
+      _store.run(*_prepared[query_id], ids);
+      setCache(query_id, ids);
+    }
+    else
+      dropDead(query_id);
+  }
+
+  // replaces the cached results of query_id with the objects with the given ids, in the memory
+  // of the old ones like refresh.  Results and cacheAdded need them in increasing order of id,
+  // which not every store returns them in.
+  void setCache(int query_id, std::vector<int> & obj_ids)
+  {
+    if (!std::is_sorted(obj_ids.begin(), obj_ids.end()))
+      std::sort(obj_ids.begin(), obj_ids.end());
+    if (_pointers[query_id])
+    {
+      auto & objs = _ptr_cache[query_id];
+      objs.clear();
+      objs.reserve(obj_ids.size());
+      for (auto id : obj_ids)
+        objs.push_back(_objects[id]);
+      trim(objs);
+    }
+    else
+    {
+      auto & ids = _obj_cache[query_id];
+      if (&ids != &obj_ids)
+        ids.assign(obj_ids.begin(), obj_ids.end());
+      trim(ids);
+    }
+    _cache_version[query_id] = _query_version[query_id];
+    _dead_cached[query_id].clear();
+    _dead_objs[query_id].clear();
+  }
+
+  // gives back the memory of cached results that shrank to well below it.  Results that only
+  // change size a little keep their memory, so that refreshing them allocates nothing.
+  template <typename T>
+  static void trim(std::vector<T> & cache)
+  {
+    if (cache.capacity() > 2 * cache.size() + min_trim)
+      cache.shrink_to_fit();
+  }
+
+  bool stale(int query_id) const { return _cache_version[query_id] != _query_version[query_id]; }
+
+  // the number of objects in the up to date cached results of query_id.
+  size_t cachedSize(int query_id) const
+  {
+    if (_pointers[query_id])
+      return _ptr_cache[query_id].size() - _dead_objs[query_id].size();
+    return _obj_cache[query_id].size() - _dead_cached[query_id].size();
+  }
+
+  // makes the cache of query_id keep pointers to the objects, converting the ids it has.
+  void usePointers(int query_id)
+  {
+    if (_pointers[query_id])
+      return;
+    dropDead(query_id);
+    auto & ids = _obj_cache[query_id];
+    auto & objs = _ptr_cache[query_id];
+    if (!stale(query_id))
+    {
+      objs.reserve(ids.size());
+      for (auto id : ids)
+        objs.push_back(_objects[id]);
+    }
+    std::vector<int>().swap(ids);
+    _pointers[query_id] = 1;
+  }
+
+  // makes the cache of query_id keep the ids of the objects, converting the pointers it has.
+  void useIds(int query_id)
+  {
+    if (!_pointers[query_id])
+      return;
+    dropDead(query_id);
+    auto & ids = _obj_cache[query_id];
+    auto & objs = _ptr_cache[query_id];
+    if (!stale(query_id))
+    {
+      ids.reserve(objs.size());
+      for (auto obj : objs)
+        ids.push_back(obj->_id);
+    }
+    std::vector<Object *>().swap(objs);
+    _pointers[query_id] = 0;
+  }
+
+  // drops the removed objects from the cached results of query_id in one pass.
+  void dropDead(int query_id)
+  {
+    if (_pointers[query_id])
+      dropDead(_ptr_cache[query_id], _dead_objs[query_id]);
+    else
+      dropDead(_obj_cache[query_id], _dead_cached[query_id]);
+  }
+
+  // the same for cached ids or pointers, and those of the removed objects.  Removed objects may
+  // be deleted already, so they are recognized by their pointers rather than looked at.
+  template <typename T>
+  static void dropDead(std::vector<T> & cache, std::vector<T> & dead)
+  {
+    if (dead.empty())
+      return;
+    std::sort(dead.begin(), dead.end(), std::less<T>());
+    cache.erase(std::remove_if(cache.begin(), cache.end(), [&](T entry) {
+      return std::binary_search(dead.begin(), dead.end(), entry, std::less<T>());
+    }), cache.end());
+    dead.clear();
+    dead.shrink_to_fit();
+  }
+
+  void compactStore()
+  {
+    dropDead();
+    _store.compact();
+    std::vector<int> new_ids(_objects.size(), -1);
+    size_t n = 0;
+    for (size_t i = 0; i < _objects.size(); i++)
+    {
+      if (!_objects[i])
+        continue;
+      new_ids[i] = n;
+      _objects[i]->_id = n;
+      if (!_shared_queries.empty())
+        _frozen[n] = _frozen[i];
+      _objects[n++] = _objects[i];
+    }
+    _objects.resize(n);
+    _objects.shrink_to_fit();
+    if (!_shared_queries.empty())
+    {
+      _frozen.resize(n);
+      _frozen.shrink_to_fit();
+    }
+    _nremoved = 0;
+
+    // the up to date caches only hold live objects now; stale ones are recomputed anyway.
+    // Compaction leaves the objects where they are, so cached pointers stay valid.
+    for (int q = 0; q < _obj_cache.size(); q++)
+    {
+      if (stale(q))
+      {
+        _obj_cache[q].clear();
+        _ptr_cache[q].clear();
+      }
+      for (auto & id : _obj_cache[q])
+        id = new_ids[id];
+    }
+  }
+
+  // marks the results of query_id for publishing at the end of the write if it is shared.
+  void changed(int query_id)
+  {
+    if (_shared[query_id] && !_republish[query_id])
+    {
+      _republish[query_id] = 1;
+      _changed.push_back(query_id);
+    }
+  }
+
+  // publishes a new version with the results of the shared queries the write changed, and
+  // retires what it replaces along with the copies of the objects the write changed or removed.
+  void publish()
+  {
+    if (_changed.empty() && _unfrozen.empty())
+      return;
+    std::unique_ptr<Replaced> replaced(new Replaced());
+    Version * next = nullptr;
+    if (!_changed.empty())
+    {
+      next = new Version(*_version.load());
+      next->results.resize(_obj_cache.size(), nullptr);
+      for (auto q : _changed)
+      {
+        refresh(q);
+        auto objs = new std::vector<const Object *>();
+        objs->reserve(cachedSize(q));
+        for (auto obj : _ptr_cache[q])
+          objs->push_back(_frozen[obj->_id]);
+        for (auto id : _obj_cache[q])
+          objs->push_back(_frozen[id]);
+        replace(*next, q, objs, *replaced);
+        _republish[q] = 0;
+      }
+      _changed.clear();
+    }
+    install(next, std::move(replaced));
+  }
+
+  // brings the cached results of the shared queries up to date with the change set just made to
+  // obj and publishes them with a new copy of obj.  Unlike other queries, which invalidate marks
+  // stale, the shared ones are updated in place: obj joins or leaves the results of those whose
+  // conditions it now matches or no longer does.  A published list is in the same order as the
+  // cache it was made from, so rather than looking every object up again like publish, the new
+  // lists are the old ones with obj's entry inserted, replaced or dropped.
+  void setShared(Object * obj)
+  {
+    int id = obj->_id;
+    std::vector<Storage::Attribute> after;
+    appendAttributes(*obj, after);
+    _unfrozen.push_back(_frozen[id]);
+    auto copy = new Object(*obj);
+    _frozen[id] = copy;
+
+    std::unique_ptr<Replaced> replaced(new Replaced());
+    auto next = new Version(*_version.load());
+    for (auto q : _shared_queries)
+    {
+      refresh(q);
+      bool now = matches(after, _query_cache[q]);
+      size_t pos = 0;
+      bool was = _pointers[q] ? toggle(_ptr_cache[q], obj, now, pos) : toggle(_obj_cache[q], id, now, pos);
+      if (!was && !now)
+        continue;
+
+      auto & old = *next->results[q];
+      auto objs = new std::vector<const Object *>();
+      objs->reserve(cachedSize(q));
+      objs->insert(objs->end(), old.begin(), old.begin() + pos);
+      if (now)
+        objs->push_back(copy);
+      objs->insert(objs->end(), old.begin() + pos + was, old.end());
+      replace(*next, q, objs, *replaced);
+    }
+    install(next, std::move(replaced));
+  }
+
+  // adds entry, the id of an object or the object itself, to cache, a query's cached results in
+  // increasing order of id, if now is set and drops it otherwise.  Returns whether cache held it
+  // and sets pos to its place.  Every object in cache must still be in the warehouse.
+  template <typename T>
+  static bool toggle(std::vector<T> & cache, T entry, bool now, size_t & pos)
+  {
+    auto it = std::lower_bound(cache.begin(), cache.end(), entry, [](T a, T b) { return idOf(a) < idOf(b); });
+    pos = it - cache.begin();
+    bool was = it != cache.end() && *it == entry;
+    if (now && !was)
+      cache.insert(it, entry);
+    else if (was && !now)
+      cache.erase(it);
+    return was;
+  }
+
+  static int idOf(int id) { return id; }
+  static int idOf(const Object * obj) { return obj->_id; }
+
+  // makes objs the results of query_id in next, a version not published yet.
+  static void replace(Version & next, int query_id, const std::vector<const Object *> * objs, Replaced & replaced)
+  {
+    if (next.results[query_id])
+      replaced.results.push_back(next.results[query_id]);
+    next.results[query_id] = objs;
+  }
+
+  // publishes next, if not null, and retires the version it replaces with the rest of replaced
+  // and the object copies in _unfrozen.
+  void install(Version * next, std::unique_ptr<Replaced> replaced)
+  {
+    if (next)
+      replaced->version = _version.exchange(next);
+    replaced->objects.swap(_unfrozen);
+    _epochs.retire(replaced.release());
+  }
+
+  void dropDead()
+  {
+    for (int q = 0; q < _obj_cache.size(); q++)
+      dropDead(q);
+  }
+
+  void checkObject(const Object * obj) const
+  {
+    if (obj->_id < 0 || obj->_id >= _objects.size() || _objects[obj->_id] != obj)
+      throw std::runtime_error("object is not in this warehouse");
+  }
+
+  // appends the just added object obj_id with the given attributes to the up to date cached
+  // results of the queries it matches.  New ids are the largest, so the results stay sorted.
+  // The object may have the address of a removed one that a cache of pointers still lists, so
+  // those drop their removed objects first.
+  template <typename Attribs>
+  void cacheAdded(int obj_id, const Attribs & attribs)
+  {
+    forEachMatchingQuery(attribs, [&](int q) {
+      if (_pointers[q])
+      {
+        dropDead(q);
+        _ptr_cache[q].push_back(_objects[obj_id]);
+      }
+      else
+        _obj_cache[q].push_back(obj_id);
+      changed(q);
+    });
+  }
+
+  // calls f(query_id) for every query with up to date cached results whose conditions an object
+  // with the given attributes satisfies.  Only the queries anchored on one of the attribute
+  // values are checked (see _anchors).
+  template <typename Attribs, typename F>
+  void forEachMatchingQuery(const Attribs & attribs, F f)
+  {
+    _visit++;
+    auto visit = [&](const std::vector<int> & query_ids) {
+      for (auto q : query_ids)
+      {
+        if (_visited[q] == _visit)
+          continue;
+        _visited[q] = _visit;
+        if (!stale(q) && matches(attribs, _query_cache[q]))
+          f(q);
+      }
+    };
+
+    visit(_unanchored);
+    for (auto & attrib : attribs)
+    {
+      if (attrib.value == Storage::wildcard && Storage::supportsWildcard(attrib.id))
+      {
+        visit(_anchored[static_cast<int>(attrib.id)]);
+        continue;
+      }
+      auto it = _anchors.find(key(attrib.id, attrib.value));
+      if (it != _anchors.end())
+        visit(it->second);
+    }
+  }
+
+  // appends obj's attributes in the form stores take them to attribs, a vector of
+  // Storage::Attribute or of Storage::Batch::Entry.
+  template <typename Attribs>
+  static void appendAttributes(const Object & obj, Attribs & attribs)
+  {
+    appendAttributes(obj, attribs, [](const std::string & s) { return symbols().intern(s); });
+  }
+
+  // the same with intern(s) giving the symbol id of each string value.
+  template <typename Attribs, typename Intern>
+  static void appendAttributes(const Object & obj, Attribs & attribs, Intern intern)
+  {
+    attribs.push_back({AttributeId::System, intern(obj.system)});
+    attribs.push_back({AttributeId::Thread, obj.thread});
+    attribs.push_back({AttributeId::Enabled, obj.enabled});
+    for (auto & tag : obj.tags)
+      attribs.push_back({AttributeId::Tag, intern(tag)});
+    if (obj.all_subdomains)
+      attribs.push_back({AttributeId::Subdomain, Storage::wildcard});
+    else
+      for (auto & sub : obj.subdomains)
+        attribs.push_back({AttributeId::Subdomain, sub});
+    if (obj.all_boundaries)
+      attribs.push_back({AttributeId::Boundary, Storage::wildcard});
+    else
+      for (auto & bound : obj.boundaries)
+        attribs.push_back({AttributeId::Boundary, bound});
+    for (auto & on : obj.execute_ons)
+      attribs.push_back({AttributeId::ExecOn, on});
+  }
+
+  // appendAttributes targets for appendBatch: one only counts the entries, the other writes them
+  // to space set aside for them.
+  struct EntryCounter
+  {
+    size_t n = 0;
+    void push_back(const Storage::Batch::Entry &) { n++; }
+  };
+
+  struct EntryWriter
+  {
+    Storage::Batch::Entry * out;
+    void push_back(const Storage::Batch::Entry & e) { *out++ = e; }
+  };
+
+  // builds the batch of objs[first, last) on the threads of pool: every thread first counts the
+  // entries of its share of the objects and, once the offsets are known, writes them in place.
+  // The threads only look strings up in the symbol table, each remembering the ids it found so
+  // that they rarely wait for the table's lock; strings it doesn't have yet are interned
+  // afterwards on this thread.
+  static void appendBatch(const std::vector<std::unique_ptr<Object>> & objs,
+                          size_t first,
+                          size_t last,
+                          Storage::Batch & batch,
+                          ThreadPool & pool)
+  {
+    size_t n = last - first;
+    int nshards = pool.size();
+    batch.offsets.resize(n + 1);
+    pool.run(nshards, [&](int s) {
+      for (size_t i = shardBegin(n, s, nshards); i < shardBegin(n, s + 1, nshards); i++)
+      {
+        EntryCounter count;
+        appendAttributes(*objs[first + i], count, [](const std::string &) { return 0; });
+        batch.offsets[i + 1] = count.n;
+      }
+    });
+    for (size_t i = 0; i < n; i++)
+      batch.offsets[i + 1] += batch.offsets[i];
+    batch.attribs.resize(batch.offsets[n]);
+
+    std::vector<std::vector<std::pair<size_t, const std::string *>>> unknown(nshards);
+    pool.run(nshards, [&](int s) {
+      size_t begin = shardBegin(n, s, nshards);
+      EntryWriter w{batch.attribs.data() + batch.offsets[begin]};
+      std::unordered_map<std::string, int> found;
+      auto find = [&](const std::string & str) {
+        auto it = found.find(str);
+        if (it != found.end())
+          return it->second;
+        int id = symbols().find(str);
+        if (id < 0)
+          unknown[s].push_back({w.out - batch.attribs.data(), &str});
+        else
+          found.emplace(str, id);
+        return id;
+      };
+      for (size_t i = begin; i < shardBegin(n, s + 1, nshards); i++)
+        appendAttributes(*objs[first + i], w, find);
+    });
+    for (auto & shard : unknown)
+      for (auto & u : shard)
+        batch.attribs[u.first].value = symbols().intern(*u.second);
+  }
+
+  // replaces the string value of a System or Tag attribute with its symbol id.
+  static void intern(Storage::Attribute & attrib)
+  {
+    if (attrib.id == AttributeId::System || attrib.id == AttributeId::Tag)
+    {
+      attrib.value = symbols().intern(attrib.strvalue);
+      attrib.strvalue.clear();
+    }
+  }
+
+  // adds v to or removes every copy of it from one of an object's multi-valued attributes.
+  template <typename T>
+  static void update(std::vector<T> & values, const T & v, bool insert)
+  {
+    if (insert)
+      values.push_back(v);
+    else
+      values.erase(std::remove(values.begin(), values.end(), v), values.end());
+  }
+
+  static void addDependent(std::vector<int> & query_ids, int query_id)
+  {
+    if (query_ids.empty() || query_ids.back() != query_id)
+      query_ids.push_back(query_id);
+  }
+
+  // marks the cached results of every query that an object gaining or losing the given
+  // attribute value may change as stale.
+  void invalidate(AttributeId id, int value)
+  {
+    const std::vector<int> * query_ids = nullptr;
+    if (value == Storage::wildcard && Storage::supportsWildcard(id))
+      query_ids = &_conditioned[static_cast<int>(id)];
+    else
+    {
+      auto it = _dependents.find(key(id, value));
+      if (it != _dependents.end())
+        query_ids = &it->second;
+    }
+    if (query_ids)
+      for (auto q : *query_ids)
+        if (!_shared[q])
+          _query_version[q]++;
+  }
+
+  static uint64_t key(AttributeId id, int value)
+  {
+    return uint64_t(static_cast<int>(id)) << 32 | uint32_t(value);
+  }
+
+  // orders attributes roughly by how few objects share one of their values; a query is anchored
+  // on its condition of the lowest rank.
+  static int anchorRank(AttributeId id)
+  {
+    switch (id)
+    {
+      case AttributeId::Subdomain:
+        return 0;
+      case AttributeId::Boundary:
+        return 1;
+      case AttributeId::System:
+        return 2;
+      case AttributeId::Thread:
+        return 3;
+      case AttributeId::ExecOn:
+      case AttributeId::Tag:
+        return 4;
+      default:
+        return 5;
+    }
+  }
+
+  // returns true if an object with the given attributes satisfies every one of conds.
+  template <typename Attribs>
+  static bool matches(const Attribs & attribs, const std::vector<Storage::Attribute> & conds)
+  {
+    for (auto & cond : conds)
+    {
+      bool found = false;
+      for (auto & attrib : attribs)
+      {
+        if (attrib.id == cond.id && (attrib.value == cond.value || (attrib.value == Storage::wildcard && Storage::supportsWildcard(attrib.id))))
+        {
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        return false;
+    }
+    return true;
+  }
+
+  Storage & _store;
+  // the objects the warehouse owns, indexed by id; removed objects leave a null entry until the
+  // next compact.
+  std::vector<Object *> _objects;
+  int _nremoved = 0;
+  // compaction waits for at least this many removed objects.
+  static const int min_compact = 1024;
+  // addObjects hands objects to the store this many at a time.
+  static const size_t batch_size = 1 << 18;
+  // cached results are only trimmed once they have more than this many free slots (see trim).
+  static const size_t min_trim = 1024;
+
+  // the cached results of every query, either the ids of the objects (for queries read with
+  // results) or the objects themselves (for those read with query, where _pointers is set).
+  std::vector<std::vector<int>> _obj_cache;
+  std::vector<std::vector<Object *>> _ptr_cache;
+  std::vector<char> _pointers;
+  // the ids refresh runs the queries read with query into, before making their pointers.
+  std::vector<int> _found;
+  // Warehouse methods all hold _mutex, except for snapshot loading the latest published version.
+  // Replaced versions, results and object copies are freed through _epochs.
+  std::mutex _mutex;
+  Epochs _epochs;
+  std::atomic<const Version *> _version;
+  // the copies of the objects that snapshots list, indexed by id like _objects and only kept
+  // while some query is shared; writes put the copies they replace in _unfrozen.
+  std::vector<const Object *> _frozen;
+  std::vector<const Object *> _unfrozen;
+  // whether each query is shared, the shared queries, and those whose results the current write
+  // changed (flagged in _republish).
+  std::vector<char> _shared;
+  std::vector<int> _shared_queries;
+  std::vector<char> _republish;
+  std::vector<int> _changed;
+  // the removed objects still in the up to date cached results of each query, by id or by
+  // pointer like the cache.
+  std::vector<std::vector<int>> _dead_cached;
+  std::vector<std::vector<Object *>> _dead_objs;
+  std::vector<std::vector<Storage::Attribute>> _query_cache;
+  // the conditions of every query as prepared by the store.
+  std::vector<std::unique_ptr<Storage::Prepared>> _prepared;
+
+  // a query's cached results are current while its cache version equals its query version; any
+  // change that may affect its results and isn't applied to the cache bumps the query version.
+  std::vector<unsigned> _query_version;
+  std::vector<unsigned> _cache_version;
+
+  // dependency index for adds.  An object can only match a query if it matches every one of the
+  // query's conditions, so each query is indexed under just one of them (its anchor, the one
+  // expected to match the fewest objects) and an added object only needs to be checked against
+  // the queries anchored on one of its attribute values.  _anchored lists the queries anchored on
+  // each attribute for objects holding the wildcard value; _unanchored holds queries without
+  // conditions.
+  static const int nattribs = static_cast<int>(AttributeId::ExecOn) + 1;
+  std::unordered_map<uint64_t, std::vector<int>> _anchors;
+  std::vector<int> _anchored[nattribs];
+  std::vector<int> _unanchored;
+
+  // dependency index for set.  A changed attribute value can only change the results of queries
+  // with a condition on that value, so every query is listed under each of its conditions in
+  // _dependents and under each attribute it has conditions on in _conditioned (for objects
+  // gaining or losing the wildcard value).
+  std::unordered_map<uint64_t, std::vector<int>> _dependents;
+  std::vector<int> _conditioned[nattribs];
+
+  // marks the queries already checked against the object being added.
+  std::vector<unsigned> _visited;
+  unsigned _visit = 0;
+};
+
+// benchBitmap compares the memory use and intersection speed of compressed bitmaps against sorted
+// id vectors for sets as dense as those of the low cardinality attributes in the main benchmark.
+int
+benchBitmap()
+{
+  int nobjects = 1000000;
+  int reps = 20;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<> dist(0, 1);
+
+  for (double density : {1.0, 0.5, 0.1, 0.02})
+  {
+    std::vector<int> va, vb;
+    Bitmap ba, bb;
+    for (int i = 0; i < nobjects; i++)
+    {
+      if (dist(gen) < density)
+      {
+        va.push_back(i);
+        ba.add(i);
+      }
+      if (dist(gen) < density)
+      {
+        vb.push_back(i);
+        bb.add(i);
+      }
+    }
+    ba.optimize();
+    bb.optimize();
+
+    std::vector<int> out;
+    long nvec = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++)
+    {
+      out.clear();
+      std::set_intersection(va.begin(), va.end(), vb.begin(), vb.end(), std::back_inserter(out));
+      nvec += out.size();
+    }
+    auto vectime = std::chrono::steady_clock::now() - start;
+
+    long nbitmap = 0;
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++)
+      nbitmap += (ba & bb).cardinality();
+    auto bitmaptime = std::chrono::steady_clock::now() - start;
+
+    if (nvec != nbitmap)
+      throw std::runtime_error("bitmap intersection disagrees with std::set_intersection");
+
+    auto us = [reps](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / reps;
+    };
+    std::cout << "density " << density << ": vector " << va.size() * sizeof(int) / 1000
+              << " kB, bitmap " << ba.bytes() / 1000 << " kB; AND vector " << us(vectime)
+              << " us, bitmap " << us(bitmaptime) << " us\n";
+  }
+  return 0;
+}
+
+// benchIntersect checks every intersection kernel against std::set_intersection on random lists
+// and then times them on lists of similar and of very different lengths.
+int
+benchIntersect()
+{
+  typedef size_t (*Kernel)(const int *, size_t, const int *, size_t, int *);
+  std::vector<std::pair<std::string, Kernel>> kernels;
+  kernels.push_back({"scalar", intersectScalar});
+  kernels.push_back({"gallop", intersectGallop});
+  if (haveSSE())
+    kernels.push_back({"sse", intersectSSE});
+  if (haveAVX2())
+    kernels.push_back({"avx2", intersectAVX2});
+  kernels.push_back({"dispatch", intersectSorted});
+
+  std::mt19937 gen(7);
+  auto randomList = [&gen](int n, int universe) {
+    std::uniform_int_distribution<> dist(0, universe - 1);
+    std::vector<int> v;
+    for (int i = 0; i < n; i++)
+      v.push_back(dist(gen));
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    return v;
+  };
+
+  int ncases = 2000;
+  std::uniform_int_distribution<> distsize(0, 3000);
+  std::uniform_int_distribution<> distuniverse(1, 20000);
+  for (int c = 0; c < ncases; c++)
+  {
+    int universe = distuniverse(gen);
+    auto a = randomList(distsize(gen), universe);
+    auto b = randomList(c % 4 == 0 ? 40 * distsize(gen) : distsize(gen), universe);
+    std::vector<int> want;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(want));
+    for (auto & k : kernels)
+    {
+      std::vector<int> got(std::min(a.size(), b.size()));
+      got.resize(k.second(a.data(), a.size(), b.data(), b.size(), got.data()));
+      auto inplace = a;
+      inplace.resize(k.second(inplace.data(), inplace.size(), b.data(), b.size(), inplace.data()));
+      if (got != want || inplace != want)
+        throw std::runtime_error("intersection kernel '" + k.first + "' disagrees with std::set_intersection");
+    }
+  }
+  std::cout << "all kernels agree with std::set_intersection on " << ncases << " random cases\n";
+
+  int reps = 20;
+  int universe = 1000000;
+  std::vector<std::pair<int, int>> sizes = {{100000, 100000}, {10000, 100000}, {1000, 500000}};
+  for (auto & size : sizes)
+  {
+    auto a = randomList(size.first, universe);
+    auto b = randomList(size.second, universe);
+    std::vector<int> out(std::min(a.size(), b.size()));
+    std::cout << "lists of " << a.size() << " and " << b.size() << " ids:";
+
+    auto start = std::chrono::steady_clock::now();
+    size_t n = 0;
+    for (int r = 0; r < reps; r++)
+      n += std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), out.begin()) - out.begin();
+    auto diff = std::chrono::steady_clock::now() - start;
+    std::cout << " std " << std::chrono::duration_cast<std::chrono::microseconds>(diff).count() / reps << " us";
+
+    for (auto & k : kernels)
+    {
+      start = std::chrono::steady_clock::now();
+      for (int r = 0; r < reps; r++)
+        n += k.second(a.data(), a.size(), b.data(), b.size(), out.data());
+      diff = std::chrono::steady_clock::now() - start;
+      std::cout << ", " << k.first << " " << std::chrono::duration_cast<std::chrono::microseconds>(diff).count() / reps << " us";
+    }
+    std::cout << " (" << n / reps / (kernels.size() + 1) << " common ids)\n";
+  }
+  return 0;
+}
+
+// makeStore returns a new store of the named kind, or nullptr for an unknown name.
+std::unique_ptr<Storage>
+makeStore(const std::string & name)
+{
+  std::unique_ptr<Storage> store;
+  if (name == "sql")
+    store.reset(new SqlStore());
+  else if (name == "sql-compact")
+    store.reset(new SqlStore(SqlStore::Schema::Compact));
+  else if (name == "vec")
+    store.reset(new VecStore());
+  else if (name == "index")
+    store.reset(new IndexStore());
+  else if (name == "bitmap")
+    store.reset(new BitmapStore());
+  return store;
+}
+
+// benchSet times disabling and re-enabling every one of 1M objects in random order with
+// Storage::set on each in-memory store, querying the enabled set after every pass.
+int
+benchSet()
+{
+  int nobjects = 1000000;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<> distthread(1, 10);
+  std::vector<int> order(nobjects);
+  for (int i = 0; i < nobjects; i++)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), gen);
+
+  for (std::string name : {"vec", "index", "bitmap"})
+  {
+    auto store = makeStore(name);
+    for (int i = 0; i < nobjects; i++)
+      store->add(i, {{AttributeId::Thread, distthread(gen), ""}, {AttributeId::Enabled, 1, ""}});
+    store->query({{AttributeId::Enabled, 1, ""}});
+
+    auto start = std::chrono::steady_clock::now();
+    long nchanged = 0;
+    for (int enabled : {0, 1})
+    {
+      for (auto id : order)
+        nchanged += store->set(id, {AttributeId::Enabled, enabled, ""}).changed;
+      if (store->query({{AttributeId::Enabled, enabled, ""}}).size() != nobjects)
+        throw std::runtime_error(name + ": query disagrees with the enabled flags set");
+    }
+    auto diff = std::chrono::steady_clock::now() - start;
+
+    if (nchanged != 2 * nobjects)
+      throw std::runtime_error(name + ": set reported the wrong number of changes");
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count();
+    std::cout << name << ": " << nchanged << " enabled toggles and 2 queries in " << ms << " ms ("
+              << ms * 1000000 / nchanged << " ns per toggle)\n";
+
+    // adding a tag to objects that have none grows their rows of the tag lists one at a time.
+    int ntagged = nobjects / 10;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ntagged; i++)
+      store->set(order[i], {AttributeId::Tag, 1, ""}, Storage::SetOp::Insert);
+    if (store->query({{AttributeId::Tag, 1, ""}}).size() != ntagged)
+      throw std::runtime_error(name + ": query disagrees with the tags inserted");
+    diff = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << ntagged << " tag inserts and 1 query in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() << " ms\n";
+  }
+
+  // the warehouse takes any nonzero Enabled value as enabled, like Object::enabled, on every store
+  // and in its cached results.
+  for (std::string name : {"vec", "index", "bitmap", "sql"})
+  {
+    auto store = makeStore(name);
+    Warehouse w(*store);
+    std::unique_ptr<Object> obj(new Object());
+    obj->enabled = false;
+    auto handle = obj.get();
+    w.addObject(std::move(obj));
+    int enabled = w.prepare({{AttributeId::Enabled, 1, ""}});
+    int disabled = w.prepare({{AttributeId::Enabled, 0, ""}});
+    w.query(enabled);
+    w.query(disabled);
+    w.set(handle, {AttributeId::Enabled, 5, ""});
+    if (!handle->enabled || w.query(enabled).size() != 1 || !w.query(disabled).empty() ||
+        store->count({{AttributeId::Enabled, 1, ""}}) != 1)
+      throw std::runtime_error(name + ": setting Enabled to 5 doesn't enable the object");
+  }
+  return 0;
+}
+
+// randomObjects returns n objects with random attributes, distributed roughly like those of the
+// main benchmark.
+std::vector<Object>
+randomObjects(int n, std::mt19937 & gen)
+{
+  std::uniform_int_distribution<> distsmall(1, 10);
+  std::uniform_int_distribution<> distsystem(1, 50);
+  std::uniform_int_distribution<> distbound(1, 1000);
+  std::uniform_int_distribution<> distsubdomain(1, 10000);
+  std::geometric_distribution<> distsubdomains_per_object(1.0 / 10.0);
+  std::geometric_distribution<> distboundaries_per_object(1.0 / 3.0);
+  std::vector<Object> objs(n);
+  for (auto & obj : objs)
+  {
+    obj.thread = distsmall(gen);
+    obj.enabled = distsmall(gen) > 1;
+    obj.system = std::to_string(distsystem(gen));
+    for (int j = 0; j < 3; j++)
+      obj.tags.push_back(std::to_string(distsmall(gen)));
+    for (int j = distboundaries_per_object(gen); j > 0; j--)
+      obj.boundaries.push_back(distbound(gen));
+    for (int j = distsubdomains_per_object(gen); j > 0; j--)
+      obj.subdomains.push_back(distsubdomain(gen));
+    for (int j = 0; j < 5; j++)
+      obj.execute_ons.push_back(distsmall(gen));
+  }
+  return objs;
+}
+
+// benchLoad times bulk loading the same objects into the index and bitmap stores with thread
+// pools of different sizes, and checks that every load answers queries like the one-thread load.
+int
+benchLoad()
+{
+  int nobjects = 1000000;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<> distsmall(1, 10);
+  auto protos = randomObjects(nobjects, gen);
+
+  std::vector<std::vector<Storage::Attribute>> queries;
+  for (int i = 0; i < 200; i++)
+  {
+    std::vector<Storage::Attribute> conds;
+    conds.push_back({AttributeId::Thread, distsmall(gen), ""});
+    if (i % 2)
+      conds.push_back({AttributeId::Tag, 0, std::to_string(distsmall(gen))});
+    if (i % 3)
+      conds.push_back({AttributeId::Subdomain, distsmall(gen), ""});
+    if (i % 5)
+      conds.push_back({AttributeId::Enabled, 1, ""});
+    queries.push_back(conds);
+  }
+
+  for (std::string name : {"index", "bitmap"})
+  {
+    std::vector<std::vector<int>> expected;
+    long ms1 = 0;
+    for (int nthreads : {1, 2, 4, 8, 16})
+    {
+      std::vector<std::unique_ptr<Object>> objs;
+      std::unordered_map<const Object *, int> index;
+      for (int i = 0; i < nobjects; i++)
+      {
+        objs.emplace_back(new Object(protos[i]));
+        index[objs.back().get()] = i;
+      }
+      auto store = makeStore(name);
+      ThreadPool pool(nthreads);
+      store->setThreadPool(&pool);
+      Warehouse w(*store);
+
+      auto start = std::chrono::steady_clock::now();
+      w.addObjects(std::move(objs));
+      auto diff = std::chrono::steady_clock::now() - start;
+
+      for (size_t q = 0; q < queries.size(); q++)
+      {
+        std::vector<int> got;
+        for (auto obj : w.query(w.prepare(queries[q])))
+          got.push_back(index[obj]);
+        if (nthreads == 1)
+          expected.push_back(got);
+        else if (got != expected[q])
+          throw std::runtime_error(name + ": query results differ from the one-thread load");
+      }
+
+      // a batch reaching back over the last objects, large enough to be loaded in parallel, must
+      // be turned away before it touches the lists, like a single object with a taken id.
+      Storage::Batch overlap;
+      for (int i = 0; i < 10000; i++)
+      {
+        overlap.attribs.push_back({AttributeId::Thread, 1});
+        overlap.endObject();
+      }
+      bool refused = false;
+      try
+      {
+        store->addBatch(nobjects - 1, overlap);
+      }
+      catch (std::runtime_error &)
+      {
+        refused = true;
+      }
+      if (!refused)
+        throw std::runtime_error(name + ": batch overlapping added objects was accepted");
+
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count();
+      if (nthreads == 1)
+        ms1 = ms;
+      std::cout << name << ": loaded " << nobjects << " objects with " << nthreads << " threads in " << ms
+                << " ms (speedup " << double(ms1) / std::max(ms, 1L) << ")\n";
+    }
+  }
+  return 0;
+}
+
+// benchCompile compares interpreting query conditions for every object (VecStore::query) with
+// running them compiled by VecStore::prepare.
+int
+benchCompile()
+{
+  int nobjects = 1000000;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<> distsmall(1, 10);
+  std::uniform_int_distribution<> distsystem(1, 50);
+  std::uniform_int_distribution<> distconds(0, 2);
+  VecStore store;
+  Warehouse w(store);
+  std::vector<std::unique_ptr<Object>> objs;
+  for (auto & proto : randomObjects(nobjects, gen))
+    objs.emplace_back(new Object(proto));
+  w.addObjects(std::move(objs));
+
+  // queries like the main benchmark's, with the string values interned like Warehouse does.
+  std::vector<std::vector<Storage::Attribute>> queries;
+  for (int i = 0; i < 100; i++)
+  {
+    std::vector<Storage::Attribute> conds;
+    if (i % 2)
+      conds.push_back({AttributeId::Thread, distsmall(gen), ""});
+    if (i % 3)
+      conds.push_back({AttributeId::System, symbols().intern(std::to_string(distsystem(gen))), ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::Tag, symbols().intern(std::to_string(distsmall(gen))), ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::Subdomain, distsmall(gen), ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::ExecOn, distsmall(gen), ""});
+    queries.push_back(conds);
+  }
+
+  // times the queries both ways, checking that they agree.
+  auto compare = [&](const std::string & name, const std::vector<std::vector<Storage::Attribute>> & queries) {
+    std::vector<std::unique_ptr<Storage::Prepared>> prepared;
+    for (auto & conds : queries)
+      prepared.push_back(store.prepare(conds));
+
+    std::vector<std::vector<int>> interpreted, compiled(queries.size());
+    auto start = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      interpreted.push_back(store.query(conds));
+    auto mid = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < prepared.size(); i++)
+      store.run(*prepared[i], compiled[i]);
+    auto end = std::chrono::steady_clock::now();
+    if (interpreted != compiled)
+      throw std::runtime_error(name + ": compiled queries disagree with interpreted ones");
+
+    auto perObject = [&](std::chrono::steady_clock::duration diff) {
+      return double(std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count()) / queries.size() / nobjects;
+    };
+    std::cout << name << ": interpreted " << perObject(mid - start) << " ns, compiled " << perObject(end - mid)
+              << " ns per object\n";
+  };
+
+  int system = symbols().intern("7");
+  int tag = symbols().intern("3");
+  compare("thread", {10, {{AttributeId::Thread, 3, ""}}});
+  compare("thread+system", {10, {{AttributeId::Thread, 3, ""}, {AttributeId::System, system, ""}}});
+  compare("enabled", {10, {{AttributeId::Enabled, 1, ""}}});
+  compare("enabled=2", {10, {{AttributeId::Enabled, 2, ""}}});
+  compare("system+tag", {10, {{AttributeId::System, system, ""}, {AttributeId::Tag, tag, ""}}});
+  compare("subdomain", {10, {{AttributeId::Subdomain, 3, ""}}});
+  compare("mixed", queries);
+  return 0;
+}
+
+// benchEstimate compares Warehouse::estimate for queries whose results aren't computed yet with
+// their actual result counts, on every store, before and after removing and changing objects.
+int
+benchEstimate()
+{
+  int nobjects = 200000;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<> distsmall(1, 10);
+  std::uniform_int_distribution<> distsystem(1, 50);
+  std::uniform_int_distribution<> distconds(0, 2);
+  auto protos = randomObjects(nobjects, gen);
+
+  std::vector<std::vector<Storage::Attribute>> queries;
+  for (int i = 0; i < 200; i++)
+  {
+    std::vector<Storage::Attribute> conds;
+    if (i % 2)
+      conds.push_back({AttributeId::Thread, distsmall(gen), ""});
+    if (i % 3)
+      conds.push_back({AttributeId::System, 0, std::to_string(distsystem(gen))});
+    if (i % 5)
+      conds.push_back({AttributeId::Enabled, 1, ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::Tag, 0, std::to_string(distsmall(gen))});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::Subdomain, distsmall(gen), ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::ExecOn, distsmall(gen), ""});
+    queries.push_back(conds);
+  }
+
+  for (std::string name : {"vec", "index", "bitmap", "sql"})
+  {
+    auto store = makeStore(name);
+    Warehouse w(*store);
+    std::vector<Object *> handles;
+    std::vector<std::unique_ptr<Object>> objs;
+    for (auto & proto : protos)
+    {
+      objs.emplace_back(new Object(proto));
+      handles.push_back(objs.back().get());
+    }
+    w.addObjects(std::move(objs));
+
+    // the q-error of an estimate is the factor by which it is off, smoothed by one object so
+    // that empty results count too.
+    auto report = [&](const std::string & when) {
+      std::vector<int> ids;
+      for (auto & conds : queries)
+        ids.push_back(w.prepare(conds));
+
+      std::vector<double> estimates;
+      auto start = std::chrono::steady_clock::now();
+      for (auto q : ids)
+        estimates.push_back(w.estimate(q));
+      auto diff = std::chrono::steady_clock::now() - start;
+
+      std::vector<double> errors;
+      double sum = 0;
+      int within2 = 0;
+      for (size_t i = 0; i < ids.size(); i++)
+      {
+        double exact = w.query(ids[i]).size() + 1;
+        double est = estimates[i] + 1;
+        errors.push_back(std::max(exact / est, est / exact));
+        sum += errors.back();
+        within2 += errors.back() <= 2;
+      }
+      std::sort(errors.begin(), errors.end());
+      double us = std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000.0 / ids.size();
+      std::cout << name << " " << when << ": " << us << " us per estimate, q-error median "
+                << errors[errors.size() / 2] << ", mean " << sum / errors.size() << ", max " << errors.back() << ", "
+                << 100 * within2 / errors.size() << "% within 2x\n";
+    };
+
+    report("loaded");
+    std::vector<std::unique_ptr<Object>> removed;
+    for (size_t i = 0; i < handles.size(); i += 10)
+      removed.push_back(w.removeObject(handles[i]));
+    for (size_t i = 1; i < handles.size(); i += 10)
+    {
+      w.set(handles[i], {AttributeId::Thread, 1, ""});
+      w.set(handles[i], {AttributeId::Tag, 0, "1"}, Storage::SetOp::Erase);
+    }
+    report("changed");
+  }
+  return 0;
+}
+
+// Dataset makes the objects and queries of the main benchmark.  Both are drawn from gen, so the
+// queries only come out the same as main's if they are made after the same number of objects.
+class Dataset
+{
+public:
+  Dataset()
+    : gen(seed),
+      _distbound(1, nboundaries),
+      _distsubdomain(1, nsubdomains),
+      _disttag(1, ntags),
+      _distexecon(1, nexecons),
+      _distthread(1, nthreads),
+      _distsystem(1, nsystems),
+      _distsubdomains_per_object(1.0 / 10.0),
+      _distboundaries_per_object(1.0 / 3.0),
+      _genall(seed + 1),
+      _distall(0.01)
+  {
+    for (int i = 0; i < ntags; i++)
+      _tags.push_back(std::to_string(i));
+    for (int i = 0; i < nsystems; i++)
+      _systems.push_back(std::to_string(i));
+  }
+
+  std::unique_ptr<Object> makeObject()
+  {
+    std::unique_ptr<Object> object(new Object());
+    auto & obj = *object;
+    obj.thread = _distthread(gen);
+    obj.enabled = true;
+    obj.system = _systems[_distsystem(gen) - 1];
+
+    for (int j = 0; j < tags_per_object; j++)
+      obj.tags.push_back(_tags[_disttag(gen) - 1]);
+    for (int j = 0; j < _distboundaries_per_object(gen); j++)
+      obj.boundaries.push_back(_distbound(gen));
+    for (int j = 0; j < _distsubdomains_per_object(gen); j++)
+      obj.subdomains.push_back(_distsubdomain(gen));
+    obj.all_boundaries = _distall(_genall);
+    obj.all_subdomains = _distall(_genall);
+    if (obj.all_boundaries)
+      obj.boundaries.clear();
+    if (obj.all_subdomains)
+      obj.subdomains.clear();
+    for (int j = 0; j < execs_per_object; j++)
+      obj.execute_ons.push_back(_distexecon(gen));
+
+    tagtally += obj.tags.size();
+    boundtally += obj.boundaries.size();
+    subdomaintally += obj.subdomains.size();
+    exectally += obj.execute_ons.size();
+    alltally += obj.all_boundaries + obj.all_subdomains;
+    allidtally += obj.all_boundaries * boundaries_per_object + obj.all_subdomains * subdomains_per_object;
+    return object;
+  }
+
+  // returns the queries, with System and Tag values given as strings like Warehouse takes them.
+  std::vector<std::vector<Storage::Attribute>> makeQueries()
+  {
+    std::uniform_int_distribution<> distbool(0, 1);
+    std::uniform_int_distribution<> distconds(0, 2);
+    std::vector<std::vector<Storage::Attribute>> queries;
+    for (int i = 0; i < nqueries; i++)
+    {
+      std::vector<Storage::Attribute> conds;
+      if (distbool(gen))
+        conds.push_back({AttributeId::Thread, _distthread(gen), ""});
+      if (distbool(gen))
+        conds.push_back({AttributeId::System, 0, _systems[_distsystem(gen) - 1]});
+
+      int n = distconds(gen);
+      for (int j = 0; j < n; j++)
+        conds.push_back({AttributeId::Tag, 0, _tags[_disttag(gen) - 1]});
+      n = distconds(gen);
+      for (int j = 0; j < n; j++)
+        conds.push_back({AttributeId::Subdomain, _disttag(gen), ""});
+      n = distconds(gen);
+      for (int j = 0; j < n; j++)
+        conds.push_back({AttributeId::Boundary, _disttag(gen), ""});
+      n = distconds(gen);
+      for (int j = 0; j < n; j++)
+        conds.push_back({AttributeId::ExecOn, _disttag(gen), ""});
+      queries.push_back(conds);
+    }
+    return queries;
   }
 
-  virtual void set(int obj_id, const Attribute & attrib) override
+  // returns queries with their System and Tag values interned, for giving them to a store directly.
+  static std::vector<std::vector<Storage::Attribute>> intern(std::vector<std::vector<Storage::Attribute>> queries)
   {
-    if (obj_id >= _system.size())
-      throw std::runtime_error("no object with id " + std::to_string(obj_id));
-    throw std::runtime_error("not implemented");
+    for (auto & q : queries)
+      for (auto & cond : q)
+        if (cond.id == AttributeId::System || cond.id == AttributeId::Tag)
+          cond.value = symbols().intern(cond.strvalue);
+    return queries;
   }
 
+  static const int seed = 7;
+  static const int nqueries = 1000;
+
+  std::mt19937 gen;
+
+  // what the objects made so far hold in total.
+  int tagtally = 0;
+  int boundtally = 0;
+  int subdomaintally = 0;
+  int exectally = 0;
+  int alltally = 0;
+  long allidtally = 0;
+
 private:
-  std::vector<std::string> _system;
-  std::vector<int> _thread;
-  std::vector<bool> _enabled;
-  std::vector<std::vector<std::string>> _tags;
-  std::vector<std::vector<int>> _boundaries;
-  std::vector<std::vector<int>> _subdomains;
-  std::vector<std::vector<int>> _execute_ons;
+  static const int nboundaries = 1000;
+  static const int nsubdomains = 10000;
+  static const int nthreads = 10;
+  static const int nsystems = 50;
+  static const int nexecons = 10;
+  static const int ntags = 10;
+
+  static const int boundaries_per_object = 1000;
+  static const int subdomains_per_object = 10000;
+  static const int tags_per_object = 3;
+  static const int execs_per_object = 5;
+
+  std::uniform_int_distribution<> _distbound;
+  std::uniform_int_distribution<> _distsubdomain;
+  std::uniform_int_distribution<> _disttag;
+  std::uniform_int_distribution<> _distexecon;
+  std::uniform_int_distribution<> _distthread;
+  std::uniform_int_distribution<> _distsystem;
+  // mean number of subdomains and boundaries per object is 10 and 3 respectively
+  std::geometric_distribution<> _distsubdomains_per_object;
+  std::geometric_distribution<> _distboundaries_per_object;
+  // about 1% of objects act on all boundaries and 1% on all subdomains.  They are picked with a
+  // generator of their own, and their lists drawn all the same and then dropped, so that the
+  // objects and queries come out as they did before there were wildcards.
+  std::mt19937 _genall;
+  std::bernoulli_distribution _distall;
+
+  std::vector<std::string> _tags;
+  std::vector<std::string> _systems;
 };
 
-class SqlStore : public Storage
+// randomQueries returns n queries like benchEstimate's, with the string values interned like
+// Warehouse does.
+std::vector<std::vector<Storage::Attribute>>
+randomQueries(int n, std::mt19937 & gen)
 {
-public:
-  SqlStore()
-    : Storage(), _db(":memory:"), _in_transaction(false)
+  std::uniform_int_distribution<> distsmall(1, 10);
+  std::uniform_int_distribution<> distsystem(1, 50);
+  std::uniform_int_distribution<> distconds(0, 2);
+  std::vector<std::vector<Storage::Attribute>> queries;
+  for (int i = 0; i < n; i++)
   {
-    _db.Execute("CREATE TABLE objects (id INTEGER PRIMARY KEY, system TEXT, thread INTEGER, enabled INTEGER);");
-    _db.Execute("CREATE TABLE subdomains (id INTEGER, subdomain INTEGER);");
-    _db.Execute("CREATE TABLE boundaries (id INTEGER, boundary INTEGER);");
-    _db.Execute("CREATE TABLE execute_ons (id INTEGER, execute_on INTEGER);");
-    _db.Execute("CREATE TABLE tags (id INTEGER, tag TEXT);");
+    std::vector<Storage::Attribute> conds;
+    if (i % 2)
+      conds.push_back({AttributeId::Thread, distsmall(gen), ""});
+    if (i % 3)
+      conds.push_back({AttributeId::System, symbols().intern(std::to_string(distsystem(gen))), ""});
+    if (i % 5)
+      conds.push_back({AttributeId::Enabled, 1, ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::Tag, symbols().intern(std::to_string(distsmall(gen))), ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::Subdomain, distsmall(gen), ""});
+    for (int j = distconds(gen); j > 0; j--)
+      conds.push_back({AttributeId::ExecOn, distsmall(gen), ""});
+    queries.push_back(conds);
+  }
+  return queries;
+}
 
-    _tblmain = _db.Prepare("INSERT INTO objects (id, system, thread, enabled) VALUES (?,?,?,?);");
-    _tbltag = _db.Prepare("INSERT INTO tags (id, tag) VALUES (?,?);");
-    _tblbound = _db.Prepare("INSERT INTO boundaries (id, boundary) VALUES (?,?);");
-    _tblsubdomain = _db.Prepare("INSERT INTO subdomains (id, subdomain) VALUES (?,?);");
-    _tblexecons = _db.Prepare("INSERT INTO execute_ons (id, execute_on) VALUES (?,?);");
+// benchCount times counting the results of queries, checking whether there are any and getting
+// the first few of them against running the queries, on every store.
+int
+benchCount()
+{
+  std::mt19937 gen(7);
+  auto protos = randomObjects(1000000, gen);
+  auto queries = randomQueries(100, gen);
+
+  for (std::string name : {"vec", "index", "bitmap", "sql"})
+  {
+    // sqlite is slow enough that a fifth of the objects will do.
+    size_t nobjects = name == "sql" ? protos.size() / 5 : protos.size();
+    auto store = makeStore(name);
+    Warehouse w(*store);
+    std::vector<std::unique_ptr<Object>> objs;
+    for (size_t i = 0; i < nobjects; i++)
+      objs.emplace_back(new Object(protos[i]));
+    w.addObjects(std::move(objs));
+
+    std::vector<std::vector<int>> results, firsts;
+    std::vector<size_t> counts;
+    std::vector<bool> anys;
+    auto start = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      results.push_back(store->query(conds));
+    auto t1 = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      counts.push_back(store->count(conds));
+    auto t2 = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      anys.push_back(store->any(conds));
+    auto t3 = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      firsts.push_back(store->first(conds, 10));
+    auto t4 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+      auto & objs = results[i];
+      if (counts[i] != objs.size() || anys[i] != !objs.empty() ||
+          firsts[i] != std::vector<int>(objs.begin(), objs.begin() + std::min(objs.size(), size_t(10))))
+        throw std::runtime_error(name + ": count, any or first disagree with query");
+    }
+
+    // the same counts from prepared queries, which is what Warehouse asks for.
+    std::vector<std::unique_ptr<Storage::Prepared>> prepared;
+    for (auto & conds : queries)
+      prepared.push_back(store->prepare(conds));
+    auto t5 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); i++)
+      if (store->runCount(*prepared[i]) != results[i].size() || store->runAny(*prepared[i]) != !results[i].empty())
+        throw std::runtime_error(name + ": runCount or runAny disagree with query");
+    auto t6 = std::chrono::steady_clock::now();
+
+    auto ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+    };
+    std::cout << name << ": " << queries.size() << " queries over " << nobjects << " objects: query " << ms(t1 - start)
+              << " ms, count " << ms(t2 - t1) << " ms, any " << ms(t3 - t2) << " ms, first 10 " << ms(t4 - t3)
+              << " ms, prepared count and any " << ms(t6 - t5) << " ms\n";
   }
+  return 0;
+}
 
-  ~SqlStore()
+// benchSql compares the sizes of the two sqlite schemas and the times of queries, counts and
+// removals on them, and then the query strategies on each schema over a few rounds of the main
+// benchmark's queries (see Dataset), which Auto needs to settle.
+int
+benchSql()
+{
+  std::mt19937 gen(7);
+  auto protos = randomObjects(200000, gen);
+  auto queries = randomQueries(100, gen);
+  std::vector<int> removed(protos.size() / 10);
+  std::uniform_int_distribution<> distid(0, protos.size() - 1);
+  for (auto & id : removed)
+    id = distid(gen);
+  std::sort(removed.begin(), removed.end());
+  removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+
+  std::vector<std::vector<int>> expected;
+  for (auto schema : {SqlStore::Schema::Rowid, SqlStore::Schema::Compact})
   {
-    auto s1 = _db.Prepare("PRAGMA PAGE_SIZE;");
-    s1->Step();
-    int pagesize = s1->GetInt(0);
+    std::string name = schema == SqlStore::Schema::Rowid ? "rowid" : "compact";
+    SqlStore store(schema);
+    store.setStrategy(SqlStore::Strategy::Join);
+    Warehouse w(store);
+    std::vector<std::unique_ptr<Object>> objs;
+    for (auto & proto : protos)
+      objs.emplace_back(new Object(proto));
+    w.addObjects(std::move(objs));
 
-    auto s2 = _db.Prepare("PRAGMA PAGE_COUNT;");
-    s2->Step();
-    int pagecount = s2->GetInt(0);
+    std::vector<std::vector<int>> results;
+    std::vector<size_t> counts;
+    auto start = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      results.push_back(store.query(conds));
+    auto t1 = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      counts.push_back(store.count(conds));
+    auto t2 = std::chrono::steady_clock::now();
+    long bytes = store.bytes();
+    for (int id : removed)
+      store.remove(id);
+    store.compact();
+    auto t3 = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      results.push_back(store.query(conds));
+    for (size_t i = 0; i < queries.size(); i++)
+      if (counts[i] != results[i].size())
+        throw std::runtime_error(name + ": count disagrees with query");
+    if (expected.empty())
+      expected = results;
+    else if (results != expected)
+      throw std::runtime_error(name + ": results differ between schemas");
 
-    std::cout << "Sqlite db size: " << pagecount * pagesize / 1000 << " kB (page_size=" << pagesize << ", pagecount=" << pagecount << ")\n";
-  };
+    auto ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+    };
+    std::cout << name << ": " << bytes / 1000 << " kB for " << protos.size() << " objects, " << queries.size()
+              << " queries: query " << ms(t1 - start) << " ms, count " << ms(t2 - t1) << " ms, removing "
+              << removed.size() << " objects and compacting " << ms(t3 - t2) << " ms\n";
+  }
 
-  virtual void add(int obj_id, const std::vector<Storage::Attribute> & attribs) override
+  // the main benchmark's objects are all made, so that the queries come out the same, but
+  // sqlite only gets a small share of them.
+  int rounds = 8;
+  size_t nobjects = 50000;
+  Dataset data;
+  std::vector<std::unique_ptr<Object>> standard;
+  for (int i = 0; i < 1000000; i++)
   {
-    if (!_in_transaction)
+    auto obj = data.makeObject();
+    if (standard.size() < nobjects)
+      standard.push_back(std::move(obj));
+  }
+  auto standard_queries = Dataset::intern(data.makeQueries());
+  for (auto schema : {SqlStore::Schema::Rowid, SqlStore::Schema::Compact})
+  {
+    std::vector<std::vector<int>> joined;
+    for (auto strategy : {SqlStore::Strategy::Join, SqlStore::Strategy::Exists, SqlStore::Strategy::Intersect,
+                          SqlStore::Strategy::Auto})
     {
-      _in_transaction = true;
-      _db.Execute("BEGIN TRANSACTION;");
-    }
+      const char * names[] = {"join", "exists", "intersect", "auto"};
+      std::string name = std::string(schema == SqlStore::Schema::Rowid ? "rowid" : "compact") + "/" +
+                         names[static_cast<int>(strategy)];
+      SqlStore store(schema);
+      store.setStrategy(strategy);
+      Warehouse w(store);
+      std::vector<std::unique_ptr<Object>> objs;
+      for (auto & obj : standard)
+        objs.emplace_back(new Object(*obj));
+      w.addObjects(std::move(objs));
 
-    bool enabled = true;
-    int thread = -1;
-    std::string system;
-    std::vector<std::string> tags;
-    std::vector<int> bounds;
-    std::vector<int> subdomains;
-    std::vector<int> execons;
-    for (auto & attrib : attribs)
-    {
-      switch (attrib.id)
+      auto & queries = standard_queries;
+      std::vector<std::unique_ptr<Storage::Prepared>> prepared;
+      for (auto & conds : queries)
+        prepared.push_back(store.prepare(conds));
+      std::vector<std::vector<int>> results(queries.size());
+      std::vector<size_t> counts(queries.size());
+      std::chrono::steady_clock::duration run(0), count(0), first(0), last(0);
+      for (int round = 0; round < rounds; round++)
       {
-        case AttributeId::Thread:
-          thread = attrib.value;
-          break;
-        case AttributeId::System:
-          system = attrib.strvalue;
-          break;
-        case AttributeId::Enabled:
-          enabled = attrib.value;
-          break;
-        case AttributeId::Boundary:
-          _tblbound->BindInt(1, obj_id);
-          _tblbound->BindInt(2, attrib.value);
-          _tblbound->Exec();
-          break;
-        case AttributeId::Subdomain:
-          _tblsubdomain->BindInt(1, obj_id);
-          _tblsubdomain->BindInt(2, attrib.value);
-          _tblsubdomain->Exec();
-          break;
-        case AttributeId::ExecOn:
-          _tblexecons->BindInt(1, obj_id);
-          _tblexecons->BindInt(2, attrib.value);
-          _tblexecons->Exec();
-          break;
-        case AttributeId::Tag:
-          _tbltag->BindInt(1, obj_id);
-          _tbltag->BindText(2, attrib.strvalue.c_str());
-          _tbltag->Exec();
-          break;
-        default:
-          throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(attrib.id)));
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < queries.size(); i++)
+          store.run(*prepared[i], results[i]);
+        auto t1 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < queries.size(); i++)
+          counts[i] = store.count(queries[i]);
+        auto t2 = std::chrono::steady_clock::now();
+        run += t1 - start;
+        count += t2 - t1;
+        if (round == 0)
+          first = t1 - start;
+        last = t1 - start;
       }
-    }
+      for (size_t i = 0; i < queries.size(); i++)
+        if (counts[i] != results[i].size())
+          throw std::runtime_error(name + ": count disagrees with query");
+      if (joined.empty())
+        joined = results;
+      else if (results != joined)
+        throw std::runtime_error(name + ": results differ between strategies");
 
-    _tblmain->BindInt(1, obj_id);
-    _tblmain->BindText(2, system.c_str());
-    _tblmain->BindInt(3, thread);
-    _tblmain->BindInt(4, enabled);
-    _tblmain->Exec();
+      auto ms = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+      };
+      std::cout << name << ": " << queries.size() << " queries over " << nobjects << " objects: run "
+                << ms(run) / rounds << " ms per round (" << ms(first) << " ms in the first, " << ms(last)
+                << " ms in the last), count " << ms(count) / rounds
+                << " ms per round\n";
+    }
   }
+  return 0;
+}
 
-  virtual std::vector<int> query(const std::vector<Storage::Attribute> & conds) override
+// benchCache checks that the warehouse's cached results give back their memory when a query's
+// results shrink, on every store, timing the refreshes before and after, and times iterating a
+// results view against iterating what query returns for the same results.
+int
+benchCache()
+{
+  std::mt19937 gen(7);
+  auto protos = randomObjects(1000000, gen);
+
+  for (std::string name : {"vec", "index", "bitmap", "sql"})
   {
-    if (_in_transaction)
+    size_t nobjects = name == "sql" ? protos.size() / 5 : protos.size();
+    auto store = makeStore(name);
+    Warehouse w(*store);
+    std::vector<Object *> handles;
+    std::vector<std::unique_ptr<Object>> objs;
+    for (size_t i = 0; i < nobjects; i++)
     {
-      _in_transaction = false;
-      _db.Execute("END TRANSACTION;");
-
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx_objects ON objects (system, thread, enabled, id);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx_subdomain ON subdomains (subdomain, id);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx_boundary ON boundaries (boundary, id);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx_tag ON tags (tag, id);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx_execute_on ON execute_ons (execute_on, id);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_objects ON objects (id, system, thread, enabled);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_subdomain ON subdomains (id, subdomain);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_boundary ON boundaries (id, boundary);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_tag ON tags (id, tag);");
-      _db.Execute("CREATE INDEX IF NOT EXISTS idx2_execute_on ON execute_ons (id, execute_on);");
-      _db.Execute("ANALYZE");
+      objs.emplace_back(new Object(protos[i]));
+      handles.push_back(objs.back().get());
     }
+    w.addObjects(std::move(objs));
 
-    std::string joins = "SELECT DISTINCT objects.id FROM objects";
-    std::string tail;
-    std::vector<std::function<void(SqlStatement::Ptr &)>> bindings;
-    int joincount = 1;
-    int tailcount = 0;
-    for (int i = 0; i < conds.size(); i++)
-    {
-      auto & cond = conds[i];
+    int enabled = w.prepare({{AttributeId::Enabled, 1, ""}});
+    int thread = w.prepare({{AttributeId::Thread, 3, ""}, {AttributeId::Enabled, 1, ""}});
+    auto start = std::chrono::steady_clock::now();
+    size_t before = w.results(enabled).size() + w.results(thread).size();
+    auto t1 = std::chrono::steady_clock::now();
+    size_t bytes_before = w.cacheBytes();
 
-      switch (cond.id)
-      {
-        case AttributeId::Thread:
-          tail += " AND objects.thread=?";
-          bindings.push_back([&joincount, tailcount, cond](SqlStatement::Ptr & stmt) { stmt->BindInt(joincount+tailcount, cond.value); });
-          tailcount++;
-          break;
-        case AttributeId::System:
-          tail += " AND objects.system=?";
-          bindings.push_back([&joincount, tailcount, cond](SqlStatement::Ptr & stmt) { stmt->BindText(joincount+tailcount, cond.strvalue.c_str()); });
-          tailcount++;
-          break;
-        case AttributeId::Enabled:
-          tail += " AND objects.enabled=?";
-          bindings.push_back([&joincount, tailcount, cond](SqlStatement::Ptr & stmt) { stmt->BindInt(joincount+tailcount, cond.value); });
-          tailcount++;
-          break;
-        case AttributeId::Boundary:
-          joins += " JOIN boundaries AS b" + std::to_string(i) + " ON objects.id=b" + std::to_string(i) + ".id AND b" + std::to_string(i) + ".boundary=?";
-          bindings.push_back([joincount, cond](SqlStatement::Ptr & stmt) { stmt->BindInt(joincount, cond.value); });
-          joincount++;
-          break;
-        case AttributeId::Subdomain:
-          joins += " JOIN subdomains AS s" + std::to_string(i) + " ON objects.id=s" + std::to_string(i) + ".id AND s" + std::to_string(i) + ".subdomain=?";
-          bindings.push_back([joincount, cond](SqlStatement::Ptr & stmt) { stmt->BindInt(joincount, cond.value); });
-          joincount++;
-          break;
-        case AttributeId::ExecOn:
-          joins += " JOIN execute_ons AS e" + std::to_string(i) + " ON objects.id=e" + std::to_string(i) + ".id AND e" + std::to_string(i) + ".execute_on=?";
-          bindings.push_back([joincount, cond](SqlStatement::Ptr & stmt) { stmt->BindInt(joincount, cond.value); });
-          joincount++;
-          break;
-        case AttributeId::Tag:
-          joins += " JOIN tags AS t" + std::to_string(i) + " ON objects.id=t" + std::to_string(i) + ".id AND t" + std::to_string(i) + ".tag=?";
-          bindings.push_back([joincount, cond](SqlStatement::Ptr & stmt) { stmt->BindText(joincount, cond.strvalue.c_str()); });
-          joincount++;
-          break;
-        default:
-          throw std::runtime_error("unknown AttributeId " + std::to_string(static_cast<int>(cond.id)));
-      }
-    }
+    // disabling all but every tenth object shrinks both queries' results to a tenth.
+    for (size_t i = 0; i < nobjects; i++)
+      if (i % 10)
+        w.set(handles[i], {AttributeId::Enabled, 0, ""});
+    auto t2 = std::chrono::steady_clock::now();
+    size_t after = w.results(enabled).size() + w.results(thread).size();
+    auto t3 = std::chrono::steady_clock::now();
+    size_t bytes_after = w.cacheBytes();
+    if (bytes_after > after * sizeof(int))
+      throw std::runtime_error(name + ": cached results keep " + std::to_string(bytes_after) + " bytes for " +
+                               std::to_string(after) + " ids");
 
-    if (tail.size() > 0)
-      tail = " WHERE " + tail.substr(4, std::string::npos);
+    // disabling a few more shrinks the results only a little, so they keep their memory.
+    for (size_t i = 0; i < nobjects; i += 1000)
+      w.set(handles[i], {AttributeId::Enabled, 0, ""});
+    if (w.results(enabled).size() + w.results(thread).size() >= after)
+      throw std::runtime_error(name + ": disabling objects didn't shrink the results");
+    if (w.cacheBytes() != bytes_after)
+      throw std::runtime_error(name + ": cached results were reallocated though they shrank only a little");
 
-    std::string sql = joins + tail + ";";
-    //std::cout << "  sql: " << sql << "\n";
-    auto stmt = _db.Prepare(sql);
-    for (auto & func : bindings)
-      func(stmt);
+    // reading a query with query turns its cache into pointers and reading it with results back
+    // into ids, without keeping both.
+    size_t nenabled = w.query(enabled).size();
+    if (w.cacheBytes() > bytes_after + nenabled * (sizeof(Object *) - sizeof(int)))
+      throw std::runtime_error(name + ": cached results keep both ids and pointers");
+    if (w.results(enabled).size() != nenabled || w.cacheBytes() > bytes_after)
+      throw std::runtime_error(name + ": cached results didn't go back to ids");
 
-    std::vector<int> objs;
-    while (stmt->Step())
-      objs.push_back(stmt->GetInt(0));
-
-    //std::cout << "  nresults=" << objs.size() << "\n";
-    //auto plan = _db.Prepare("EXPLAIN QUERY PLAN " + sql + ";");
-    //std::cout << "query plan:\n";
-    //while (plan->Step())
-    //{
-    //  int n = 0;
-    //  char * s = plan->GetText(3, &n);
-    //  std::string text(s, n);
-    //  std::cout << "    " << plan->GetInt(0) << "|" << plan->GetInt(1) << "|" << plan->GetInt(2) << "|   " << text << "\n";
-    //}
+    // a view held while objects are removed leaves them out rather than handing out objects the
+    // warehouse no longer has, also once a set made its query out of date, and counts the same
+    // objects as it iterates over.
+    auto view = w.results(enabled);
+    std::vector<Object *> listed;
+    for (auto & obj : view)
+      listed.push_back(&obj);
+    std::unordered_set<Object *> removed;
+    for (size_t i = 0; i < 3; i++)
+      removed.insert(listed[i]);
+    w.set(listed[3], {AttributeId::Enabled, 0, ""});
+    for (size_t i = 4; i < 7; i++)
+      removed.insert(listed[i]);
+    for (auto obj : removed)
+      w.removeObject(obj);
+    size_t nseen = 0;
+    for (auto & obj : view)
+    {
+      if (removed.count(&obj))
+        throw std::runtime_error(name + ": results view lists a removed object");
+      nseen++;
+    }
+    if (nseen != listed.size() - removed.size() || view.size() != nseen)
+      throw std::runtime_error(name + ": results view miscounts after removing objects");
 
-    return objs;
-  }
+    // iterating cached ids looks every object up in the warehouse; time it against iterating the
+    // pointers query returns for the same results.
+    int reps = 10;
+    int all = w.prepare({});
+    int all_ptrs = w.prepare({});
+    auto all_view = w.results(all);
+    auto & ptrs = w.query(all_ptrs);
+    long viewsum = 0;
+    long ptrsum = 0;
+    auto t4 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++)
+      for (auto & obj : all_view)
+        viewsum += obj.thread;
+    auto t5 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++)
+      for (auto obj : ptrs)
+        ptrsum += obj->thread;
+    auto t6 = std::chrono::steady_clock::now();
+    if (viewsum != ptrsum)
+      throw std::runtime_error(name + ": results and query disagree");
 
-  virtual void set(int obj_id, const Storage::Attribute & attrib) override
-  {
-    throw std::runtime_error("not implemented");
+    auto ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+    };
+    std::cout << name << ": cache " << bytes_before / 1000 << " kB for " << before << " ids (" << ms(t1 - start)
+              << " ms), then " << bytes_after / 1000 << " kB for " << after << " ids (" << ms(t3 - t2)
+              << " ms); iterating " << ptrs.size() << " results " << ms(t5 - t4) / reps << " ms, through query's pointers "
+              << ms(t6 - t5) / reps << " ms\n";
   }
+  return 0;
+}
 
-private:
-  SqliteDb _db;
-  bool _in_transaction;
-  SqlStatement::Ptr _tblmain;
-  SqlStatement::Ptr _tbltag;
-  SqlStatement::Ptr _tblbound;
-  SqlStatement::Ptr _tblsubdomain;
-  SqlStatement::Ptr _tblexecons;
-};
-
-class Warehouse
+// benchStream times the ways of getting the results of prepared queries on every store:
+// query, which returns a new vector each time, run into buffers that are reused from one round
+// to the next like Warehouse does with its cache, and cursors, also timing their first batch.
+int
+benchStream()
 {
-public:
-  Warehouse(Storage & s)
-    : _store(s){};
+  std::mt19937 gen(7);
+  auto protos = randomObjects(1000000, gen);
+  auto queries = randomQueries(100, gen);
 
-  void addObject(std::unique_ptr<Object> obj)
+  for (std::string name : {"vec", "index", "bitmap", "sql"})
   {
-    for (int i = 0; i < _query_dirty.size(); i++)
-      _query_dirty[i] = true;
+    size_t nobjects = name == "sql" ? protos.size() / 5 : protos.size();
+    auto store = makeStore(name);
+    Warehouse w(*store);
+    std::vector<std::unique_ptr<Object>> objs;
+    for (size_t i = 0; i < nobjects; i++)
+      objs.emplace_back(new Object(protos[i]));
+    w.addObjects(std::move(objs));
 
-    std::vector<Storage::Attribute> attribs;
-    attribs.push_back({AttributeId::System, 0, obj->system});
-    attribs.push_back({AttributeId::Thread, obj->thread, ""});
-    attribs.push_back({AttributeId::Enabled, obj->enabled, ""});
-    for (auto & tag : obj->tags)
-      attribs.push_back({AttributeId::Tag, 0, tag});
-    for (auto & sub : obj->subdomains)
-      attribs.push_back({AttributeId::Subdomain, sub, ""});
-    for (auto & bound : obj->boundaries)
-      attribs.push_back({AttributeId::Boundary, bound, ""});
-    for (auto & on : obj->execute_ons)
-      attribs.push_back({AttributeId::ExecOn, on, ""});
-
-    _objects.push_back(std::move(obj));
-    _store.add(_objects.size() - 1, attribs);
+    std::vector<std::unique_ptr<Storage::Prepared>> prepared;
+    for (auto & conds : queries)
+      prepared.push_back(store->prepare(conds));
+
+    std::vector<std::vector<int>> results, buffers(queries.size()), streamed(queries.size());
+    auto start = std::chrono::steady_clock::now();
+    for (auto & conds : queries)
+      results.push_back(store->query(conds));
+    auto t1 = std::chrono::steady_clock::now();
+    for (int round = 0; round < 2; round++)
+      for (size_t i = 0; i < prepared.size(); i++)
+        store->run(*prepared[i], buffers[i]);
+    auto t2 = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration first(0);
+    std::vector<int> batch;
+    for (size_t i = 0; i < prepared.size(); i++)
+    {
+      auto opened = std::chrono::steady_clock::now();
+      auto cursor = store->open(*prepared[i]);
+      bool more = cursor->next(batch);
+      first += std::chrono::steady_clock::now() - opened;
+      for (; more; more = cursor->next(batch))
+        streamed[i].insert(streamed[i].end(), batch.begin(), batch.end());
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    if (buffers != results || streamed != results)
+      throw std::runtime_error(name + ": run or cursors disagree with query");
+
+    auto ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+    };
+    std::cout << name << ": " << queries.size() << " queries over " << nobjects << " objects: query " << ms(t1 - start)
+              << " ms, run " << ms(t2 - t1) / 2 << " ms per round, cursor " << ms(t3 - t2) << " ms ("
+              << ms(first) << " ms to the first batch)\n";
   }
+  return 0;
+}
 
-  // prepares a query and returns an associated query_id (i.e. for use with the query function.
-  int prepare(const std::vector<Storage::Attribute> & conds)
+// benchConcurrent measures how many query snapshots reader threads get while a writer keeps
+// changing objects, for different numbers of readers, and checks that the objects a snapshot
+// lists match its query while the writer changes them and that warehouses on different threads
+// can intern strings at the same time.
+int
+benchConcurrent()
+{
+  int nobjects = 200000;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<> distsmall(1, 10);
+  IndexStore store;
+  Warehouse w(store);
+  std::vector<Object *> handles;
+  std::vector<std::unique_ptr<Object>> objs;
+  for (auto & proto : randomObjects(nobjects, gen))
   {
-    auto obj_ids = _store.query(conds);
-
-    _query_dirty.push_back(true);
-    _obj_cache.push_back({});
-    _query_cache.push_back(conds);
+    objs.emplace_back(new Object(proto));
+    handles.push_back(objs.back().get());
+  }
+  w.addObjects(std::move(objs));
 
-    return _obj_cache.size() - 1;
+  // the writer toggles enabled flags, which changes the results of the queries with an enabled
+  // condition.
+  std::vector<int> queries;
+  std::vector<int> threads;
+  for (int i = 0; i < 100; i++)
+  {
+    std::vector<Storage::Attribute> conds;
+    threads.push_back(distsmall(gen));
+    conds.push_back({AttributeId::Thread, threads.back(), ""});
+    conds.push_back({AttributeId::Tag, 0, std::to_string(distsmall(gen))});
+    if (i % 4 == 0)
+      conds.push_back({AttributeId::Enabled, 1, ""});
+    queries.push_back(w.prepare(conds));
+    w.share(queries.back());
   }
 
-  const std::vector<Object *> & query(int query_id)
+  for (int nreaders : {1, 2, 4, 8})
   {
-    if (query_id >= _obj_cache.size())
-      throw std::runtime_error("unknown query id");
+    std::atomic<bool> stop(false);
+    std::atomic<long> nreads(0);
+    long nwrites = 0;
+    std::thread writer([&] {
+      std::mt19937 gen(nreaders);
+      std::uniform_int_distribution<> distobj(0, nobjects - 1);
+      while (!stop)
+      {
+        w.set(handles[distobj(gen)], {AttributeId::Enabled, int(nwrites % 2), ""});
+        nwrites++;
+      }
+    });
+    std::vector<std::thread> readers;
+    for (int r = 0; r < nreaders; r++)
+      readers.emplace_back([&, r] {
+        std::mt19937 gen(r);
+        long n = 0;
+        while (!stop)
+        {
+          int q = gen() % queries.size();
+          auto snap = w.snapshot(queries[q]);
+          if (snap.size() > size_t(nobjects))
+            throw std::runtime_error("snapshot larger than the warehouse");
+          // one object per snapshot keeps the check from dominating the timing.
+          if (snap.size() > 0)
+          {
+            auto obj = snap.objects()[gen() % snap.size()];
+            if (obj->thread != threads[q] || (q % 4 == 0 && !obj->enabled))
+              throw std::runtime_error("snapshot lists an object its query doesn't match");
+          }
+          n++;
+        }
+        nreads += n;
+      });
+
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    stop = true;
+    writer.join();
+    for (auto & t : readers)
+      t.join();
+    std::cout << nreaders << " readers: " << nreads << " snapshots/s with " << nwrites << " writes/s\n";
+  }
 
-    if (_query_dirty[query_id])
+  // removes, adds and compaction publish the shared queries too: afterwards every snapshot lists
+  // copies of the objects query gives.
+  std::vector<std::unique_ptr<Object>> more;
+  for (auto & proto : randomObjects(1000, gen))
+    more.emplace_back(new Object(proto));
+  w.addObjects(std::move(more));
+  for (int i = 0; i < nobjects; i += 100)
+    w.removeObject(handles[i]);
+  w.compact();
+  for (auto q : queries)
+  {
+    auto snap = w.snapshot(q);
+    auto & view = w.query(q);
+    if (snap.size() != view.size())
+      throw std::runtime_error("snapshot and query disagree on the number of results");
+    size_t i = 0;
+    for (auto obj : view)
     {
-      auto & vec = _obj_cache[query_id];
-      vec.clear();
-      for (auto & id : _store.query(_query_cache[query_id]))
-        vec.push_back(_objects[id].get());
-      _query_dirty[query_id] = false;
+      auto copy = snap.objects()[i++];
+      if (copy->thread != obj->thread || copy->enabled != obj->enabled || copy->tags != obj->tags)
+        throw std::runtime_error("snapshot and query disagree on the results");
     }
-
-    return _obj_cache[query_id];
   }
 
-private:
-  Storage & _store;
-  std::vector<std::unique_ptr<Object>> _objects;
-
-  std::vector<std::vector<Object *>> _obj_cache;
-  std::vector<std::vector<Storage::Attribute>> _query_cache;
-  std::vector<bool> _query_dirty;
-};
-
-// not needed?
-int
-tagid(const std::string & s)
-{
-  static std::map<std::string, int> ids;
-  if (ids.count(s) == 0)
-    ids[s] = ids.size();
-  return ids[s];
+  // warehouses used from different threads intern their new strings in the same symbol table.
+  std::vector<std::thread> loaders;
+  std::vector<size_t> found(4);
+  for (int t = 0; t < 4; t++)
+    loaders.emplace_back([&found, t] {
+      IndexStore own_store;
+      Warehouse own(own_store);
+      std::string prefix = "loader" + std::to_string(t) + "/";
+      for (int i = 0; i < 1000; i++)
+      {
+        std::unique_ptr<Object> obj(new Object());
+        obj->system = prefix;
+        obj->tags.push_back(prefix + std::to_string(i % 100));
+        own.addObject(std::move(obj));
+      }
+      found[t] = own.query(own.prepare({{AttributeId::Tag, 0, prefix + "7"}})).size();
+    });
+  for (auto & t : loaders)
+    t.join();
+  for (auto n : found)
+    if (n != 10)
+      throw std::runtime_error("warehouses on different threads disagree on interned strings");
+  return 0;
 }
 
 int
 main(int argc, char ** argv)
 {
+  if (argc > 1 && std::string(argv[1]) == "bench-bitmap")
+    return benchBitmap();
+  if (argc > 1 && std::string(argv[1]) == "bench-intersect")
+    return benchIntersect();
+  if (argc > 1 && std::string(argv[1]) == "bench-set")
+    return benchSet();
+  if (argc > 1 && std::string(argv[1]) == "bench-load")
+    return benchLoad();
+  if (argc > 1 && std::string(argv[1]) == "bench-concurrent")
+    return benchConcurrent();
+  if (argc > 1 && std::string(argv[1]) == "bench-compile")
+    return benchCompile();
+  if (argc > 1 && std::string(argv[1]) == "bench-estimate")
+    return benchEstimate();
+  if (argc > 1 && std::string(argv[1]) == "bench-count")
+    return benchCount();
+  if (argc > 1 && std::string(argv[1]) == "bench-stream")
+    return benchStream();
+  if (argc > 1 && std::string(argv[1]) == "bench-sql")
+    return benchSql();
+  if (argc > 1 && std::string(argv[1]) == "bench-cache")
+    return benchCache();
+
   //////////////////// create objects /////////////////////////////
-  int nboundaries = 1000;
-  int nsubdomains = 10000;
-  int nthreads = 10;
-  int nsystems = 50;
-  int nexecons = 10;
-  int ntags = 10;
   int nobjects = 1000000;
-
-  int boundaries_per_object = 1000;
-  int subdomains_per_object = 10000;
-  int tags_per_object = 3;
-  int execs_per_object = 5;
-
-  int seed = 7;
-  std::mt19937 gen(seed);
-  std::uniform_int_distribution<> distbound(1, nboundaries);
-  std::uniform_int_distribution<> distsubdomain(1, nsubdomains);
-  std::uniform_int_distribution<> disttag(1, ntags);
-  std::uniform_int_distribution<> distexecon(1, nexecons);
-  std::uniform_int_distribution<> distthread(1, nthreads);
-  std::uniform_int_distribution<> distsystem(1, nsystems);
-  // mean number of subdomains and boundaries per object is 10 and 3 respectively
-  std::geometric_distribution<> distsubdomains_per_object(1.0 / 10.0);
-  std::geometric_distribution<> distboundaries_per_object(1.0 / 3.0);
-
-  std::vector<std::string> tags;
-  for (int i = 0; i < ntags; i++)
-    tags.push_back(std::to_string(i));
-
-  std::vector<std::string> systems;
-  for (int i = 0; i < nsystems; i++)
-    systems.push_back(std::to_string(i));
-
-  int tagtally = 0;
-  int boundtally = 0;
-  int subdomaintally = 0;
-  int exectally = 0;
-
+  Dataset data;
   std::vector<std::unique_ptr<Object>> objects;
   for (int i = 0; i < nobjects; i++)
   {
     if (i % 1000 == 0)
       std::cout << "created " << i << " objects\n";
-    auto object = new Object();
-    objects.emplace_back(object);
-    auto & obj = *objects[i];
-    obj.thread = distthread(gen);
-    obj.enabled = true;
-    obj.system = systems[distsystem(gen) - 1];
-
-    for (int j = 0; j < tags_per_object; j++)
-      obj.tags.push_back(tags[disttag(gen) - 1]);
-    for (int j = 0; j < distboundaries_per_object(gen); j++)
-      obj.boundaries.push_back(distbound(gen));
-    for (int j = 0; j < distsubdomains_per_object(gen); j++)
-      obj.subdomains.push_back(distsubdomain(gen));
-    for (int j = 0; j < execs_per_object; j++)
-      obj.execute_ons.push_back(distexecon(gen));
-
-    tagtally += obj.tags.size();
-    boundtally += obj.boundaries.size();
-    subdomaintally += obj.subdomains.size();
-    exectally += obj.execute_ons.size();
+    objects.push_back(data.makeObject());
   }
 
   ////////////// create queries /////////////////////
-  int nqueries = 1000;
-  int conds_per_query = 10;
-  std::uniform_int_distribution<> distbool(0, 1);
-  std::uniform_int_distribution<> distconds(0, 2);
-  std::vector<std::vector<Storage::Attribute>> queries;
-  for (int i = 0; i < nqueries; i++)
-  {
-    std::vector<Storage::Attribute> conds;
-    if (distbool(gen))
-      conds.push_back({AttributeId::Thread, distthread(gen), ""});
-    if (distbool(gen))
-      conds.push_back({AttributeId::System, 0, systems[distsystem(gen) - 1]});
-
-    int n = distconds(gen);
-    for (int j = 0; j < n; j++)
-      conds.push_back({AttributeId::Tag, 0, tags[disttag(gen) - 1]});
-    n = distconds(gen);
-    for (int j = 0; j < n; j++)
-      conds.push_back({AttributeId::Subdomain, disttag(gen), ""});
-    n = distconds(gen);
-    for (int j = 0; j < n; j++)
-      conds.push_back({AttributeId::Boundary, disttag(gen), ""});
-    n = distconds(gen);
-    for (int j = 0; j < n; j++)
-      conds.push_back({AttributeId::ExecOn, disttag(gen), ""});
-    queries.push_back(conds);
-  }
+  auto queries = data.makeQueries();
 
   //////////////////// insert objects ////////////////////////////////
-  SqlStore sstore;
-  VecStore vstore;
-  Warehouse w(sstore);
+  std::string storename = argc > 1 ? argv[1] : "sql";
+  auto store = makeStore(storename);
+  if (!store)
+  {
+    std::cerr << "unknown store '" << storename << "' (want one of sql, sql-compact, vec, index, bitmap)\n";
+    return 1;
+  }
+  // an optional second argument sets the number of threads for bulk work.
+  int nworkers = argc > 2 ? std::stoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+  ThreadPool pool(nworkers);
+  store->setThreadPool(&pool);
+  Warehouse w(*store);
 
-  auto start = std::chrono::steady_clock::now();
+  std::vector<Object *> handles;
   for (auto & obj : objects)
-    w.addObject(std::move(obj));
+    handles.push_back(obj.get());
+  auto start = std::chrono::steady_clock::now();
+  w.addObjects(std::move(objects));
   auto end = std::chrono::steady_clock::now();
 
   auto diff = end - start;
@@ -617,11 +5977,75 @@ main(int argc, char ** argv)
   diff = end - start;
   std::cout << "query 2nd time: " << std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() << " ms (" << countn << " total results)\n";
 
+  // interleaved adds and queries; added objects update the cached results in place
+  int ninterleaved = 100;
+  countn = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ninterleaved; i++)
+  {
+    auto obj = data.makeObject();
+    handles.push_back(obj.get());
+    w.addObject(std::move(obj));
+    for (auto & q : queryids)
+      countn += w.query(q).size();
+  }
+  end = std::chrono::steady_clock::now();
+  diff = end - start;
+  std::cout << "interleaved " << ninterleaved << " adds with all queries: " << std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() << " ms (" << countn << " total results)\n";
+
+  // churn: every cycle removes a tenth of the objects and adds as many new ones, then runs all
+  // queries against the store directly; compaction keeps the query time from creeping up.
+  auto interned = Dataset::intern(queries);
+  int ncycles = 5;
+  int nchurn = nobjects / 10;
+  for (int c = 0; c < ncycles; c++)
+  {
+    start = std::chrono::steady_clock::now();
+    std::shuffle(handles.begin(), handles.end(), data.gen);
+    for (int i = 0; i < nchurn; i++)
+    {
+      w.removeObject(handles.back());
+      handles.pop_back();
+    }
+    for (int i = 0; i < nchurn; i++)
+    {
+      auto obj = data.makeObject();
+      handles.push_back(obj.get());
+      w.addObject(std::move(obj));
+    }
+    auto churntime = std::chrono::steady_clock::now() - start;
+
+    countn = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto & q : interned)
+      countn += store->count(q);
+    diff = std::chrono::steady_clock::now() - start;
+    std::cout << "churn cycle " << c + 1 << ": " << nchurn << " removes and adds in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(churntime).count() << " ms, store queries "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() << " ms (" << countn << " total results)\n";
+  }
+
+  // the queries prepared again and computed together by refreshAll rather than one by one like
+  // in the 1st run.  It comes last so that the caches it adds don't slow the runs before.
+  countn = 0;
+  start = std::chrono::steady_clock::now();
+  std::vector<int> batchids;
+  for (auto & q : queries)
+    batchids.push_back(w.prepare(q));
+  w.refreshAll();
+  for (auto & q : batchids)
+    countn += w.count(q);
+  diff = std::chrono::steady_clock::now() - start;
+  std::cout << "query 1st time with refreshAll: " << std::chrono::duration_cast<std::chrono::milliseconds>(diff).count()
+            << " ms (" << countn << " total results)\n";
+
   std::cout << "total stored items:\n";
-  std::cout << "    tags = " << tagtally << "\n";
-  std::cout << "    subdomains = " << subdomaintally << "\n";
-  std::cout << "    boundaries = " << boundtally << "\n";
-  std::cout << "    execute_ons = " << exectally << "\n";
+  std::cout << "    tags = " << data.tagtally << "\n";
+  std::cout << "    subdomains = " << data.subdomaintally << "\n";
+  std::cout << "    boundaries = " << data.boundtally << "\n";
+  std::cout << "    execute_ons = " << data.exectally << "\n";
+  std::cout << "    all boundaries/subdomains wildcards = " << data.alltally << " (instead of " << data.allidtally
+            << " listed ids)\n";
 
   return 0;
 }
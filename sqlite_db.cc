@@ -133,3 +133,16 @@ void SqliteDb::Execute(std::string sql) {
   sqlite3_finalize(statement);
 }
 
+void SqliteDb::SetInterrupt(std::function<bool()> stop) {
+  open();
+  stop_ = stop;
+  if (stop_) {
+    sqlite3_progress_handler(db_, 1000, &SqliteDb::Progress, this);
+  } else {
+    sqlite3_progress_handler(db_, 0, NULL, NULL);
+  }
+}
+
+int SqliteDb::Progress(void* db) {
+  return static_cast<SqliteDb*>(db)->stop_() ? 1 : 0;
+}
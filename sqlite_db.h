@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <functional>
 
 class sqlite3;
 class sqlite3_stmt;
@@ -99,10 +100,18 @@ class SqliteDb {
   /// @throw IOError SQL command execution failed (e.g. invalid SQL)
   void Execute(std::string cmd);
 
+  /// Makes statements stop stepping with an interrupt error once stop returns
+  /// true.  stop is called every few thousand virtual machine instructions
+  /// while a statement runs; an empty function removes it again.
+  void SetInterrupt(std::function<bool()> stop);
+
  private:
+  static int Progress(void* db);
+
   sqlite3* db_;
   bool isOpen_;
   std::string path_;
+  std::function<bool()> stop_;
 };
 
 #endif  // CYCLUS_SRC_SQLITE_DB_H_
@@ -0,0 +1,90 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int nthreads) : _next(0)
+{
+  for (int i = 1; i < nthreads; i++)
+    _workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _start.notify_all();
+  for (auto & t : _workers)
+    t.join();
+}
+
+void
+ThreadPool::run(int n, const std::function<void(int)> & f)
+{
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_running || _workers.empty())
+    {
+      lock.unlock();
+      for (int i = 0; i < n; i++)
+        f(i);
+      return;
+    }
+    _running = true;
+    _loop = &f;
+    _n = n;
+    _next = 0;
+    _busy = _workers.size();
+    _error = nullptr;
+    _generation++;
+  }
+  _start.notify_all();
+
+  drain();
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _finish.wait(lock, [this] { return _busy == 0; });
+  _running = false;
+  _loop = nullptr;
+  if (_error)
+    std::rethrow_exception(_error);
+}
+
+void
+ThreadPool::work()
+{
+  unsigned seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _start.wait(lock, [&] { return _stop || _generation != seen; });
+      if (_stop)
+        return;
+      seen = _generation;
+    }
+
+    drain();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_busy == 0)
+      _finish.notify_one();
+  }
+}
+
+void
+ThreadPool::drain()
+{
+  for (int i = _next++; i < _n; i = _next++)
+  {
+    try
+    {
+      (*_loop)(i);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_error)
+        _error = std::current_exception();
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool runs one parallel loop at a time on a fixed set of threads.  The iterations of a
+// loop are handed out one by one from a shared counter, so threads that finish their iterations
+// early keep taking the remaining ones and uneven iterations still balance out.  The thread
+// calling run works on the loop too.
+class ThreadPool
+{
+public:
+  // starts nthreads - 1 worker threads; the caller of run is the last one.
+  explicit ThreadPool(int nthreads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  int size() const { return _workers.size() + 1; }
+
+  // calls f(i) for every i in [0, n) spread over the pool's threads and returns once all calls
+  // are done, rethrowing the first exception any of them threw.  Calls from inside f don't
+  // start a nested loop but run all of their iterations on the calling thread.
+  void run(int n, const std::function<void(int)> & f);
+
+private:
+  void work();
+  void drain();
+
+  std::vector<std::thread> _workers;
+
+  std::mutex _mutex;
+  std::condition_variable _start;
+  std::condition_variable _finish;
+  // the current loop; _generation counts loops so that workers notice a new one.
+  const std::function<void(int)> * _loop = nullptr;
+  int _n = 0;
+  std::atomic<int> _next;
+  unsigned _generation = 0;
+  int _busy = 0;
+  bool _running = false;
+  bool _stop = false;
+  std::exception_ptr _error;
+};
+
+#endif // THREAD_POOL_H_